@@ -1,19 +1,72 @@
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <stdio.h>
 #include <string>
 #include <string.h>
 #include <stdlib.h>
 #include <list>
+#include <vector>
 #include <pthread.h>
+#include <time.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../log/log.h"
 
 using namespace std;
 
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//pthread_cond_timedwait用的是CLOCK_REALTIME的绝对时间
+static struct timespec deadline_after(long long ms)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+//这些错误说明连接已经断了，不能再放回连接池
+static bool connection_lost(MYSQL *con)
+{
+	switch (mysql_errno(con))
+	{
+	case CR_CONNECTION_ERROR:
+	case CR_CONN_HOST_ERROR:
+	case CR_SERVER_GONE_ERROR:
+	case CR_SERVER_LOST:
+	case CR_SERVER_LOST_EXTENDED:
+		return true;
+	default:
+		return false;
+	}
+}
+
 connection_pool::connection_pool()
 {
 	this->CurConn = 0;
 	this->FreeConn = 0;
+	this->Opening = 0;
+	this->Waiting = 0;
+	this->MaxConn = 0;
+	this->MinConn = 0;
+	this->m_stop = false;
+	this->m_started = false;
+	memset(m_wait_hist, 0, sizeof(m_wait_hist));
+	m_connect_failures = 0;
+	m_lost = 0;
+	m_grows = 0;
+	m_shrinks = 0;
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -23,107 +76,389 @@ connection_pool *connection_pool::GetInstance()
 }
 
 //构造初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, unsigned int MaxConn)
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, unsigned int MaxConn, unsigned int MinConn)
 {
 	this->url = url;
 	this->Port = Port;
 	this->User = User;
 	this->PassWord = PassWord;
 	this->DatabaseName = DBName;
+	this->MinConn = MinConn;
+	this->MaxConn = MaxConn < MinConn ? MinConn : MaxConn;
 
-	lock.lock();
-	for (int i = 0; i < MaxConn; i++)
+	//mysql_library_init不是线程安全的，要在并行连接之前调用一次
+	mysql_library_init(0, NULL, NULL);
+
+	//每个连接一个线程同时去连，启动时间是一次连接的耗时而不是MinConn次
+	vector<pthread_t> openers;
+	for (unsigned int i = 0; i < MinConn; i++)
 	{
-		MYSQL *con = NULL;
-		con = mysql_init(con);
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, open_thread, this) == 0)
+			openers.push_back(tid);
+		else
+			Open();
+	}
+	for (size_t i = 0; i < openers.size(); ++i)
+		pthread_join(openers[i], NULL);
 
-		if (con == NULL)
-		{
-			cout << "Error:" << mysql_error(con);
-			exit(1);
-		}
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
+	if (FreeConn < MinConn)
+		LOG_ERROR("connection pool: only %u of %u connection(s) opened, retrying in background", FreeConn, MinConn);
+
+	if (pthread_create(&m_maintainer, NULL, maintain_thread, this) != 0)
+		LOG_ERROR("%s", "connection pool: create maintain thread failure");
+	else
+		m_started = true;
+}
+
+//新建一个连接，失败返回NULL，不持有lock时调用
+MYSQL *connection_pool::Connect()
+{
+	MYSQL *con = mysql_init(NULL);
+
+	if (con == NULL)
+	{
+		LOG_ERROR("%s", "mysql_init failure");
+		return NULL;
+	}
+	if (mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DatabaseName.c_str(), Port, NULL, 0) == NULL)
+	{
+		LOG_ERROR("mysql connect error: %s", mysql_error(con));
+		mysql_close(con);
+		return NULL;
+	}
 
-		if (con == NULL)
+	//预处理失败的语句留空，GetStatement返回NULL，由调用方按数据库错误处理
+	vector<MYSQL_STMT *> stmts(m_sql.size(), (MYSQL_STMT *)NULL);
+	for (size_t i = 0; i < m_sql.size(); ++i)
+	{
+		MYSQL_STMT *stmt = mysql_stmt_init(con);
+		if (stmt && mysql_stmt_prepare(stmt, m_sql[i].c_str(), m_sql[i].size()) == 0)
+			stmts[i] = stmt;
+		else
 		{
-			cout << "Error: " << mysql_error(con);
-			exit(1);
+			LOG_ERROR("mysql prepare error: %s", stmt ? mysql_stmt_error(stmt) : mysql_error(con));
+			if (stmt)
+				mysql_stmt_close(stmt);
 		}
-		connList.push_back(con);
-		++FreeConn;
 	}
 
-	reserve = sem(FreeConn);
+	lock.lock();
+	m_stmts[con].swap(stmts);
+	lock.unlock();
+	return con;
+}
+
+//关闭连接和它上面的预处理语句，不持有lock时调用
+void connection_pool::Close(MYSQL *con)
+{
+	vector<MYSQL_STMT *> stmts;
 
-	this->MaxConn = FreeConn;
-	
+	lock.lock();
+	map<MYSQL *, vector<MYSQL_STMT *> >::iterator it = m_stmts.find(con);
+	if (it != m_stmts.end())
+	{
+		stmts.swap(it->second);
+		m_stmts.erase(it);
+	}
 	lock.unlock();
+
+	for (size_t i = 0; i < stmts.size(); ++i)
+		if (stmts[i])
+			mysql_stmt_close(stmts[i]);
+	mysql_close(con);
 }
 
+int connection_pool::AddStatement(const char *sql)
+{
+	m_sql.push_back(sql);
+	return (int)m_sql.size() - 1;
+}
 
-//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
-MYSQL *connection_pool::GetConnection()
+MYSQL_STMT *connection_pool::GetStatement(MYSQL *con, int id)
 {
-	MYSQL *con = NULL;
+	MYSQL_STMT *stmt = NULL;
 
-	if (0 == connList.size())
-		return NULL;
+	lock.lock();
+	map<MYSQL *, vector<MYSQL_STMT *> >::iterator it = m_stmts.find(con);
+	if (it != m_stmts.end() && id >= 0 && id < (int)it->second.size())
+		stmt = it->second[id];
+	lock.unlock();
+	return stmt;
+}
+
+void *connection_pool::open_thread(void *arg)
+{
+	((connection_pool *)arg)->Open();
+	mysql_thread_end();		//释放客户端库给这个线程分配的资源
+	return NULL;
+}
+
+//新建一个连接放进连接池
+void connection_pool::Open()
+{
+	MYSQL *con = Connect();
 
-	reserve.wait();
-	
 	lock.lock();
+	if (con == NULL)
+		++m_connect_failures;
+	else
+	{
+		long long now = now_ms();
+		pooled_conn pc = {con, now, now};
+		connList.push_back(pc);
+		++FreeConn;
+	}
+	lock.unlock();
+	if (con)
+		m_cond.signal();
+}
 
-	con = connList.front();
-	connList.pop_front();
+//持有lock时调用，取最近放回的连接，最久没用的留在表头，方便后台线程回收
+MYSQL *connection_pool::PopFree()
+{
+	MYSQL *con = connList.back().con;
+	connList.pop_back();
 
 	--FreeConn;
 	++CurConn;
+	return con;
+}
+
+//持有lock时调用
+void connection_pool::record_wait(long long wait_ms, bool timeout)
+{
+	int bucket;
+	if (timeout)
+		bucket = 5;
+	else if (wait_ms < 1)
+		bucket = 0;
+	else if (wait_ms < 10)
+		bucket = 1;
+	else if (wait_ms < 100)
+		bucket = 2;
+	else if (wait_ms < 1000)
+		bucket = 3;
+	else
+		bucket = 4;
+	++m_wait_hist[bucket];
+}
+
+//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+//没有空闲连接时先等GROW_WAIT_MS，还没有且没到上限就自己新建一个，否则等到timeout_ms为止
+MYSQL *connection_pool::GetConnection(int timeout_ms)
+{
+	MYSQL *con = NULL;
+	bool tried = false;		//每次调用最多新建一次，数据库不可用时不反复重连
+	long long start = now_ms();
+
+	lock.lock();
+	++Waiting;
+	while (!m_stop)
+	{
+		if (FreeConn > 0)
+		{
+			con = PopFree();
+			break;
+		}
+
+		long long waited = now_ms() - start;
+		if (!tried && waited >= GROW_WAIT_MS && CurConn + FreeConn + Opening < MaxConn)
+		{
+			tried = true;
+			++Opening;
+			lock.unlock();
+			con = Connect();
+			lock.lock();
+			--Opening;
+			if (con)
+			{
+				++CurConn;
+				++m_grows;
+				break;
+			}
+			++m_connect_failures;
+			continue;
+		}
+		if (waited >= timeout_ms)
+			break;
 
+		long long wake = (!tried && waited < GROW_WAIT_MS) ? GROW_WAIT_MS : timeout_ms;
+		m_cond.timewait(lock.get(), deadline_after(wake - waited));
+	}
+	--Waiting;
+	record_wait(now_ms() - start, con == NULL);
 	lock.unlock();
 	return con;
 }
 
-//释放当前使用的连接
+//释放当前使用的连接，已经断开的连接直接关闭，由后台线程或下一个取连接的线程补上
 bool connection_pool::ReleaseConnection(MYSQL *con)
 {
 	if (NULL == con)
 		return false;
 
+	if (connection_lost(con))
+	{
+		LOG_WARN("mysql connection lost: %s", mysql_error(con));
+		Close(con);
+
+		lock.lock();
+		--CurConn;
+		++m_lost;
+		lock.unlock();
+		return true;
+	}
+
 	lock.lock();
 
-	connList.push_back(con);
+	long long now = now_ms();
+	pooled_conn pc = {con, now, now};
+	connList.push_back(pc);
 	++FreeConn;
 	--CurConn;
 
 	lock.unlock();
 
-	reserve.post();
+	m_cond.signal();
 	return true;
 }
 
-//销毁数据库连接池
-void connection_pool::DestroyPool()
+void *connection_pool::maintain_thread(void *arg)
 {
+	((connection_pool *)arg)->maintain();
+	return NULL;
+}
 
-	lock.lock();
-	if (connList.size() > 0)
+//后台线程：关掉空闲太久的多余连接，ping空闲的连接，断开的重连，连接数补到MinConn
+//ping和连接都在锁外做，被检查的连接先从空闲链表里取出来，算作使用中
+void connection_pool::maintain()
+{
+	vector<pooled_conn> to_check;
+	vector<MYSQL *> to_close;
+
+	while (true)
 	{
-		list<MYSQL *>::iterator it;
-		for (it = connList.begin(); it != connList.end(); ++it)
+		lock.lock();
+		if (!m_stop)
+			m_maint_cond.timewait(lock.get(), deadline_after(MAINTAIN_INTERVAL_MS));
+		if (m_stop)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);
+			lock.unlock();
+			break;
 		}
-		CurConn = 0;
-		FreeConn = 0;
-		connList.clear();
 
+		long long now = now_ms();
+		unsigned int total = CurConn + FreeConn + Opening;
+		for (list<pooled_conn>::iterator it = connList.begin(); it != connList.end();)
+		{
+			if (total > MinConn && Waiting == 0 && now - it->idle_since >= SHRINK_IDLE_MS)
+			{
+				to_close.push_back(it->con);
+				--FreeConn;
+				--total;
+				++m_shrinks;
+			}
+			else if (now - it->checked_at >= PING_IDLE_MS)
+			{
+				to_check.push_back(*it);
+				--FreeConn;
+				++CurConn;
+			}
+			else
+			{
+				++it;
+				continue;
+			}
+			it = connList.erase(it);
+		}
+		unsigned int refill = total < MinConn ? MinConn - total : 0;
+		Opening += refill;
 		lock.unlock();
+
+		for (size_t i = 0; i < to_close.size(); ++i)
+			Close(to_close[i]);
+		to_close.clear();
+
+		for (size_t i = 0; i < to_check.size(); ++i)
+		{
+			pooled_conn pc = to_check[i];
+			bool lost = mysql_ping(pc.con) != 0;
+			if (lost)
+			{
+				LOG_WARN("mysql ping failure: %s, reconnecting", mysql_error(pc.con));
+				Close(pc.con);
+				pc.con = Connect();
+				pc.idle_since = now_ms();
+			}
+			pc.checked_at = now_ms();
+
+			lock.lock();
+			--CurConn;
+			if (lost)
+			{
+				++m_lost;
+				if (pc.con == NULL)
+					++m_connect_failures;
+			}
+			if (pc.con)
+			{
+				connList.push_back(pc);
+				++FreeConn;
+			}
+			lock.unlock();
+			if (pc.con)
+				m_cond.signal();
+		}
+		to_check.clear();
+
+		for (unsigned int i = 0; i < refill; ++i)
+		{
+			Open();
+			lock.lock();
+			--Opening;
+			lock.unlock();
+		}
 	}
+}
 
+//输出连接池的统计，收到SIGUSR1时调用
+void connection_pool::dump_stats()
+{
+	lock.lock();
+	LOG_INFO("stats: mysql pool %u in use, %u free, %u opening, %u waiting, min %u max %u",
+			 CurConn, FreeConn, Opening, Waiting, MinConn, MaxConn);
+	LOG_INFO("stats: mysql pool wait <1ms %lu, <10ms %lu, <100ms %lu, <1s %lu, >=1s %lu, timeout %lu",
+			 m_wait_hist[0], m_wait_hist[1], m_wait_hist[2], m_wait_hist[3], m_wait_hist[4], m_wait_hist[5]);
+	LOG_INFO("stats: mysql pool grow %lu, shrink %lu, lost %lu, connect failure %lu",
+			 m_grows, m_shrinks, m_lost, m_connect_failures);
 	lock.unlock();
 }
 
+//销毁数据库连接池
+void connection_pool::DestroyPool()
+{
+	lock.lock();
+	m_stop = true;
+	lock.unlock();
+	m_maint_cond.broadcast();
+	m_cond.broadcast();
+
+	if (m_started)
+	{
+		pthread_join(m_maintainer, NULL);
+		m_started = false;
+	}
+
+	list<pooled_conn> conns;
+	lock.lock();
+	conns.swap(connList);
+	FreeConn = 0;
+	lock.unlock();
+	for (list<pooled_conn>::iterator it = conns.begin(); it != conns.end(); ++it)
+		Close(it->con);
+}
+
 //当前空闲的连接数
 int connection_pool::GetFreeConn()
 {
@@ -137,11 +472,11 @@ connection_pool::~connection_pool()
 
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
 	*SQL = connPool->GetConnection();
-	
+
 	conRAII = *SQL;
 	poolRAII = connPool;
 }
 
 connectionRAII::~connectionRAII(){
 	poolRAII->ReleaseConnection(conRAII);
-}
\ No newline at end of file
+}
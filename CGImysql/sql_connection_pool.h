@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <list>
+#include <vector>
+#include <map>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -12,38 +14,86 @@
 
 using namespace std;
 
+#define ACQUIRE_TIMEOUT_MS 1000	//取连接最多等这么久，超时返回NULL
+#define GROW_WAIT_MS 5			//等了这么久还没有空闲连接，且没到上限，就新建一个
+#define MAINTAIN_INTERVAL_MS 1000 //后台线程检查连接的间隔
+#define PING_IDLE_MS 30000		//空闲超过这么久的连接在后台ping一次
+#define SHRINK_IDLE_MS 60000	//连接数超过下限时，空闲超过这么久的连接被关闭
+#define WAIT_BUCKETS 6			//取连接等待时间的直方图：<1ms <10ms <100ms <1s >=1s 超时
+
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection(int timeout_ms = ACQUIRE_TIMEOUT_MS); //获取数据库连接，超时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
 	int GetFreeConn();					 //获取连接
 	void DestroyPool();					 //销毁所有连接
+	void dump_stats();					 //输出连接池的统计
+
+	//预处理语句：init之前登记SQL，返回语句编号；每个连接建立时把登记的语句都预处理好
+	//之后用GetStatement(连接, 编号)取出来绑定参数执行，服务器不用每次重新解析，参数也不会被拼进SQL
+	int AddStatement(const char *sql);
+	MYSQL_STMT *GetStatement(MYSQL *con, int id); //con必须是从连接池取出的，语句随连接一起归还
 
 	//单例模式
 	static connection_pool *GetInstance();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, unsigned int MaxConn); 
-	
+	//并行地建MinConn个连接，不够时按需增加到MaxConn个；连不上数据库也不退出，由后台线程重连
+	void init(string url, string User, string PassWord, string DataBaseName, int Port, unsigned int MaxConn, unsigned int MinConn = 1);
+
 	connection_pool();
 	~connection_pool();
 
+private:
+	struct pooled_conn
+	{
+		MYSQL *con;
+		long long idle_since;	//放回连接池的时间，毫秒
+		long long checked_at;	//最近一次确认连接可用的时间，毫秒
+	};
+
+	MYSQL *Connect();
+	void Close(MYSQL *con);
+	static void *open_thread(void *arg);
+	void Open();
+	MYSQL *PopFree();
+	static void *maintain_thread(void *arg);
+	void maintain();
+	void record_wait(long long wait_ms, bool timeout);
+
 private:
 	unsigned int MaxConn;  //最大连接数
+	unsigned int MinConn;  //最小连接数
 	unsigned int CurConn;  //当前已使用的连接数
 	unsigned int FreeConn; //当前空闲的连接数
+	unsigned int Opening;  //正在建立的连接数，算在总数里，防止超过上限
+	unsigned int Waiting;  //正在等连接的线程数
+	bool m_stop;
+	bool m_started;		   //后台线程是否已启动
+	pthread_t m_maintainer;
 
 private:
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_cond;			 //有连接放回或新建时通知等待者
+	cond m_maint_cond;		 //只用来唤醒后台线程退出
+	list<pooled_conn> connList; //连接池
+	vector<string> m_sql;		//登记的预处理语句，init之后只读
+	map<MYSQL *, vector<MYSQL_STMT *> > m_stmts; //每个连接上预处理好的语句，下标是语句编号
 
 private:
 	string url;			 //主机地址
-	string Port;		 //数据库端口号
+	int Port;			 //数据库端口号
 	string User;		 //登陆数据库用户名
 	string PassWord;	 //登陆数据库密码
 	string DatabaseName; //使用数据库名
+
+private:
+	//统计，都在lock下更新
+	unsigned long m_wait_hist[WAIT_BUCKETS];
+	unsigned long m_connect_failures;	//新建连接失败的次数
+	unsigned long m_lost;				//使用中或ping时发现断开的连接数
+	unsigned long m_grows;
+	unsigned long m_shrinks;
 };
 
 class connectionRAII{
@@ -51,7 +101,7 @@ class connectionRAII{
 public:
 	connectionRAII(MYSQL **con, connection_pool *connPool);
 	~connectionRAII();
-	
+
 private:
 	MYSQL *conRAII;
 	connection_pool *poolRAII;
@@ -0,0 +1,239 @@
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "user_batcher.h"
+#include "../log/log.h"
+
+using namespace std;
+
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//pthread_cond_timedwait用的是CLOCK_REALTIME的绝对时间
+static struct timespec deadline_after(long long ms)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+user_batcher::user_batcher()
+{
+	m_connPool = NULL;
+	for (int i = 0; i <= BATCH_MAX_ROWS; ++i)
+		m_stmt[i] = -1;
+	m_first_at = 0;
+	m_stop = false;
+	m_started = false;
+	m_bind.resize(2 * BATCH_MAX_ROWS);
+	m_batches = 0;
+	m_rows = 0;
+	m_fallbacks = 0;
+	m_failed = 0;
+	m_busy = 0;
+}
+
+user_batcher::~user_batcher()
+{
+	stop();
+}
+
+user_batcher *user_batcher::GetInstance()
+{
+	static user_batcher batcher;
+	return &batcher;
+}
+
+//一次写1、2、4…BATCH_MAX_ROWS行各一条语句，任意行数都能拆成其中几条
+void user_batcher::register_statements(connection_pool *connPool)
+{
+	m_connPool = connPool;
+	for (int k = 1; k <= BATCH_MAX_ROWS; k <<= 1)
+	{
+		string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+		for (int i = 1; i < k; ++i)
+			sql += ",(?, ?)";
+		m_stmt[k] = connPool->AddStatement(sql.c_str());
+	}
+}
+
+bool user_batcher::start()
+{
+	if (pthread_create(&m_tid, NULL, worker, this) != 0)
+	{
+		LOG_ERROR("%s", "create user batcher thread failure");
+		return false;
+	}
+	m_started = true;
+	return true;
+}
+
+//已经排队的注册写完再退出
+void user_batcher::stop()
+{
+	m_lock.lock();
+	m_stop = true;
+	m_lock.unlock();
+	m_cond.broadcast();
+	if (m_started)
+	{
+		pthread_join(m_tid, NULL);
+		m_started = false;
+	}
+}
+
+bool user_batcher::submit(user_write *w)
+{
+	m_lock.lock();
+	if (m_stop || !m_started || m_queue.size() >= BATCH_MAX_PENDING)
+	{
+		++m_busy;
+		m_lock.unlock();
+		w->status = user_write::BUSY;
+		return false;
+	}
+	w->status = user_write::PENDING;
+	if (m_queue.empty())
+		m_first_at = now_ms();
+	m_queue.push_back(w);
+	//只在队列从空变非空和攒满一批时唤醒写库线程，其余时候它在等凑批的超时
+	bool wake = m_queue.size() == 1 || m_queue.size() == BATCH_MAX_ROWS;
+	m_lock.unlock();
+	if (wake)
+		m_cond.signal();
+	return true;
+}
+
+void *user_batcher::worker(void *arg)
+{
+	((user_batcher *)arg)->run();
+	return NULL;
+}
+
+void user_batcher::run()
+{
+	vector<user_write *> batch;
+
+	while (true)
+	{
+		m_lock.lock();
+		while (m_queue.empty() && !m_stop)
+			m_cond.wait(m_lock.get());
+		if (m_queue.empty())
+		{
+			m_lock.unlock();
+			break;
+		}
+		//等凑满一批，或者最早的一条等满BATCH_FLUSH_MS
+		while (!m_stop && m_queue.size() < BATCH_MAX_ROWS)
+		{
+			long long left = m_first_at + BATCH_FLUSH_MS - now_ms();
+			if (left <= 0)
+				break;
+			m_cond.timewait(m_lock.get(), deadline_after(left));
+		}
+		//剩下的已经等过了，m_first_at不变，下一轮马上写
+		size_t n = m_queue.size() < BATCH_MAX_ROWS ? m_queue.size() : BATCH_MAX_ROWS;
+		batch.assign(m_queue.begin(), m_queue.begin() + n);
+		m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+		m_lock.unlock();
+
+		flush(batch);
+		batch.clear();
+	}
+}
+
+//在一个事务里写入一批，失败就回滚后逐条写，最后逐条回调
+void user_batcher::flush(vector<user_write *> &batch)
+{
+	int n = (int)batch.size();
+	bool fallback = false;
+	MYSQL *con = NULL;
+	connectionRAII mysqlcon(&con, m_connPool);
+
+	if (!con)
+	{
+		for (int i = 0; i < n; ++i)
+			batch[i]->status = user_write::FAILED;
+	}
+	else if (!mysql_query(con, "START TRANSACTION") && insert_rows(con, &batch[0], n) && !mysql_query(con, "COMMIT"))
+	{
+		for (int i = 0; i < n; ++i)
+			batch[i]->status = user_write::OK;
+	}
+	else
+	{
+		fallback = true;
+		mysql_query(con, "ROLLBACK");
+		for (int i = 0; i < n; ++i)
+			batch[i]->status = insert_rows(con, &batch[i], 1) ? user_write::OK : user_write::FAILED;
+	}
+
+	m_lock.lock();
+	++m_batches;
+	m_rows += n;
+	if (fallback)
+		++m_fallbacks;
+	for (int i = 0; i < n; ++i)
+		if (batch[i]->status != user_write::OK)
+			++m_failed;
+	m_lock.unlock();
+
+	for (int i = 0; i < n; ++i)
+		batch[i]->done(batch[i]);
+}
+
+//n行按2的幂从大到小拆成几条语句执行
+bool user_batcher::insert_rows(MYSQL *con, user_write **rows, int n)
+{
+	int done = 0;
+	for (int k = BATCH_MAX_ROWS; k >= 1; k >>= 1)
+	{
+		while (n - done >= k)
+		{
+			MYSQL_STMT *stmt = m_connPool->GetStatement(con, m_stmt[k]);
+			if (!stmt)
+				return false;
+			memset(&m_bind[0], 0, 2 * k * sizeof(MYSQL_BIND));
+			for (int i = 0; i < k; ++i)
+			{
+				user_write *w = rows[done + i];
+				m_bind[2 * i].buffer_type = MYSQL_TYPE_STRING;
+				m_bind[2 * i].buffer = (void *)w->name;
+				m_bind[2 * i].buffer_length = strlen(w->name);
+				m_bind[2 * i + 1].buffer_type = MYSQL_TYPE_STRING;
+				m_bind[2 * i + 1].buffer = (void *)w->password;
+				m_bind[2 * i + 1].buffer_length = strlen(w->password);
+			}
+			if (mysql_stmt_bind_param(stmt, &m_bind[0]) || mysql_stmt_execute(stmt))
+			{
+				LOG_ERROR("INSERT error:%s", mysql_stmt_error(stmt));
+				return false;
+			}
+			done += k;
+		}
+	}
+	return true;
+}
+
+//输出写库的统计，收到SIGUSR1时调用
+void user_batcher::dump_stats()
+{
+	m_lock.lock();
+	LOG_INFO("stats: user batcher %lu batch(es), %lu row(s), %lu fallback(s), %lu failed, %lu busy, %d pending",
+			 m_batches, m_rows, m_fallbacks, m_failed, m_busy, (int)m_queue.size());
+	m_lock.unlock();
+}
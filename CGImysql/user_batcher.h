@@ -0,0 +1,63 @@
+#ifndef _USER_BATCHER_
+#define _USER_BATCHER_
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "sql_connection_pool.h"
+#include "user_store.h"
+#include "../lock/locker.h"
+
+using namespace std;
+
+#define BATCH_MAX_ROWS 64		//一次INSERT最多写这么多行，必须是2的幂
+#define BATCH_FLUSH_MS 10		//第一条注册进队后最多等这么久就写库
+#define BATCH_MAX_PENDING 10000 //排队等写库的注册数上限，满了拒绝
+
+// 注册的写后合并：注册先进内存表，再交给这里排队，写库线程攒够BATCH_MAX_ROWS条或等满BATCH_FLUSH_MS就用一条多行INSERT写入
+// 一批在一个事务里提交，提交后逐条回调确认；整批失败(比如有一条重名)就回滚，改为逐条写入，各自确认
+// 多行INSERT按2的幂拆成几条预处理语句，语句在连接建立时就预处理好
+class user_batcher
+{
+public:
+	static user_batcher *GetInstance();
+
+	//在连接池init之前调用，登记预处理语句
+	void register_statements(connection_pool *connPool);
+	//启动写库线程
+	bool start();
+	void stop();
+
+	//任意线程调用，返回false表示队列满，记录的status为BUSY，不会回调
+	bool submit(user_write *w);
+	void dump_stats();
+
+private:
+	user_batcher();
+	~user_batcher();
+	static void *worker(void *arg);
+	void run();
+	void flush(vector<user_write *> &batch);
+	bool insert_rows(MYSQL *con, user_write **rows, int n);
+
+private:
+	connection_pool *m_connPool;
+	int m_stmt[BATCH_MAX_ROWS + 1]; //m_stmt[k]是一次写k行的语句编号，只有2的幂有效
+	locker m_lock;
+	cond m_cond;
+	deque<user_write *> m_queue;
+	long long m_first_at;	//队列里最早一条的进队时间，毫秒
+	bool m_stop;
+	bool m_started;
+	pthread_t m_tid;
+	vector<MYSQL_BIND> m_bind;	//只被写库线程使用
+
+	//统计，在m_lock下更新
+	unsigned long m_batches;
+	unsigned long m_rows;
+	unsigned long m_fallbacks; //整批失败改为逐条写的次数
+	unsigned long m_failed;
+	unsigned long m_busy;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "user_snapshot.h"
+
+using namespace std;
+
+static const char SNAPSHOT_MAGIC[8] = {'T', 'W', 'S', 'U', 'S', 'E', 'R', 0};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+user_snapshot::user_snapshot() : m_map(NULL), m_map_size(0), m_header(NULL), m_slots(NULL), m_arena(NULL)
+{
+}
+
+user_snapshot::~user_snapshot()
+{
+	if (m_map)
+		munmap(m_map, m_map_size);
+}
+
+//for_each和find直接按文件里的长度和偏移访问，这里先确认它们都落在数据区内：
+//数据区按记录走一遍正好走到末尾，条数和头部一致；每个非空槽的偏移指向的记录整条都在数据区里
+static bool valid_layout(const user_snapshot::header *h, const user_snapshot::slot *slots, const unsigned char *arena)
+{
+	const unsigned char *p = arena, *end = arena + h->arena_size;
+	uint64_t count = 0;
+	while (p < end)
+	{
+		if (end - p < 2 || (size_t)(end - p) < 2 + (size_t)p[0] + p[1])
+			return false;
+		p += 2 + p[0] + p[1];
+		++count;
+	}
+	if (count != h->count)
+		return false;
+	for (uint32_t i = 0; i < h->nslots; ++i)
+	{
+		uint64_t off = slots[i].off;
+		if (!off)
+			continue;
+		if (off - 1 + 2 > h->arena_size)
+			return false;
+		const unsigned char *rec = arena + off - 1;
+		if (off - 1 + 2 + rec[0] + rec[1] > h->arena_size)
+			return false;
+	}
+	return true;
+}
+
+bool user_snapshot::open(const char *path)
+{
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header))
+	{
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	//各部分的大小要和文件大小对得上，槽数是2的幂，记录和槽都不越界
+	//要把槽表和数据区都读一遍，坏文件返回false，调用方从数据库全量读
+	const header *h = (const header *)map;
+	const slot *slots = (const slot *)(h + 1);
+	const unsigned char *arena = (const unsigned char *)(slots + h->nslots);
+	size_t need = sizeof(header) + (size_t)h->nslots * sizeof(slot) + h->arena_size;
+	if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h->version != SNAPSHOT_VERSION ||
+		h->nslots == 0 || (h->nslots & (h->nslots - 1)) != 0 || h->arena_size > (uint64_t)st.st_size ||
+		need != (size_t)st.st_size || !valid_layout(h, slots, arena))
+	{
+		munmap(map, st.st_size);
+		return false;
+	}
+	//登录查找是随机访问，不要预读
+	madvise(map, st.st_size, MADV_RANDOM);
+
+	m_map = map;
+	m_map_size = st.st_size;
+	m_header = h;
+	m_slots = slots;
+	m_arena = arena;
+	return true;
+}
+
+const unsigned char *user_snapshot::find(const char *name, uint64_t hash) const
+{
+	if (!m_header)
+		return NULL;
+	size_t len = strlen(name);
+	uint32_t mask = m_header->nslots - 1, tag = (uint32_t)(hash >> 32);
+	for (uint32_t i = (uint32_t)hash & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n)
+	{
+		const slot &s = m_slots[i];
+		if (!s.off)
+			return NULL;
+		if (s.tag != tag)
+			continue;
+		const unsigned char *rec = m_arena + s.off - 1;
+		if (rec[0] == len && memcmp(rec + 2, name, len) == 0)
+			return rec;
+	}
+	return NULL;
+}
+
+bool user_snapshot::check(const char *name, uint64_t hash, const char *password) const
+{
+	const unsigned char *rec = find(name, hash);
+	return rec && rec[1] == strlen(password) && memcmp(rec + 2 + rec[0], password, rec[1]) == 0;
+}
+
+bool user_snapshot::contains(const char *name, uint64_t hash) const
+{
+	return find(name, hash) != NULL;
+}
+
+bool user_snapshot::writer::add(const char *name, size_t name_len, uint64_t hash, const char *password, size_t password_len)
+{
+	if (name_len > 255 || password_len > 255 || m_arena.size() + 2 + name_len + password_len >= UINT32_MAX)
+		return false;
+	m_hashes.push_back(hash);
+	m_offsets.push_back((uint32_t)m_arena.size() + 1);
+	m_arena.push_back((unsigned char)name_len);
+	m_arena.push_back((unsigned char)password_len);
+	m_arena.insert(m_arena.end(), name, name + name_len);
+	m_arena.insert(m_arena.end(), password, password + password_len);
+	return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	while (len > 0)
+	{
+		ssize_t n = ::write(fd, p, len);
+		if (n < 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool user_snapshot::writer::finish(const char *path, uint64_t cursor)
+{
+	uint32_t nslots = 16;
+	while (nslots < 2 * m_hashes.size())
+		nslots <<= 1;
+	vector<slot> slots(nslots);
+	memset(&slots[0], 0, nslots * sizeof(slot));
+	for (size_t k = 0; k < m_hashes.size(); ++k)
+	{
+		uint32_t i = (uint32_t)m_hashes[k] & (nslots - 1);
+		while (slots[i].off)
+			i = (i + 1) & (nslots - 1);
+		slots[i].tag = (uint32_t)(m_hashes[k] >> 32);
+		slots[i].off = m_offsets[k];
+	}
+
+	header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	h.version = SNAPSHOT_VERSION;
+	h.nslots = nslots;
+	h.count = m_hashes.size();
+	h.cursor = cursor;
+	h.arena_size = m_arena.size();
+
+	string tmp = string(path) + ".tmp";
+	//快照里是明文密码，只给自己读写；上次留下的.tmp可能是别的权限，再设一遍
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+	if (fchmod(fd, 0600) != 0)
+	{
+		close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	bool ok = write_all(fd, &h, sizeof(h)) && write_all(fd, &slots[0], nslots * sizeof(slot)) &&
+			  (m_arena.empty() || write_all(fd, &m_arena[0], m_arena.size())) && fsync(fd) == 0;
+	close(fd);
+	//rename之后正在mmap旧文件的进程不受影响
+	if (!ok || rename(tmp.c_str(), path) != 0)
+	{
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
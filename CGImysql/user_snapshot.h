@@ -0,0 +1,79 @@
+#ifndef _USER_SNAPSHOT_
+#define _USER_SNAPSHOT_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+// 用户表的磁盘快照，启动时mmap进来直接查，不用从数据库整表读
+// 文件格式(本机字节序)：
+//   头部 snapshot_header
+//   nslots个槽，每个8字节：hash的高32位 + 记录在数据区的偏移+1(0表示空槽)，线性探测，装载率不超过一半
+//   数据区，每条记录：用户名长度(1字节) 密码长度(1字节) 用户名 密码，不以0结尾
+// cursor是写快照时已经包含的user表最大id，启动后从它往后增量读
+class user_snapshot
+{
+public:
+	struct header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t nslots;
+		uint64_t count;
+		uint64_t cursor;
+		uint64_t arena_size;
+	};
+	struct slot
+	{
+		uint32_t tag;
+		uint32_t off;
+	};
+
+	user_snapshot();
+	~user_snapshot();
+
+	//打开并校验快照，文件不存在或者损坏返回false，之后只读
+	bool open(const char *path);
+	bool check(const char *name, uint64_t hash, const char *password) const;
+	bool contains(const char *name, uint64_t hash) const;
+	uint64_t cursor() const { return m_header ? m_header->cursor : 0; }
+	size_t size() const { return m_header ? m_header->count : 0; }
+
+	//按文件里的顺序遍历每条记录
+	template <typename F>
+	void for_each(F fn) const
+	{
+		const unsigned char *p = m_arena, *end = m_arena + (m_header ? m_header->arena_size : 0);
+		while (p < end)
+		{
+			fn((const char *)p + 2, p[0], (const char *)p + 2 + p[0], p[1]);
+			p += 2 + p[0] + p[1];
+		}
+	}
+
+	// 写快照：逐条add，最后finish写到path.tmp再rename，写的过程中旧文件照常可用
+	class writer
+	{
+	public:
+		bool add(const char *name, size_t name_len, uint64_t hash, const char *password, size_t password_len);
+		bool finish(const char *path, uint64_t cursor);
+
+	private:
+		vector<unsigned char> m_arena;
+		vector<uint64_t> m_hashes;
+		vector<uint32_t> m_offsets;
+	};
+
+private:
+	const unsigned char *find(const char *name, uint64_t hash) const;
+
+	void *m_map;
+	size_t m_map_size;
+	const header *m_header;
+	const slot *m_slots;
+	const unsigned char *m_arena;
+};
+
+#endif
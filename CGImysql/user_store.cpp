@@ -0,0 +1,146 @@
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "user_store.h"
+#include "sql_connection_pool.h"
+#include "user_batcher.h"
+#include "../log/log.h"
+
+using namespace std;
+
+user_store *user_store::create(const char *spec)
+{
+	if (strcmp(spec, "mysql") == 0)
+		return new mysql_user_store("127.0.0.1", "root", "746f7657465952fd", "yourdb", 3306, 16, 4); //最少4个连接，按需增加到16个
+	if (strncmp(spec, "mem:", 4) == 0)
+	{
+		char *end = NULL;
+		unsigned long long n = strtoull(spec + 4, &end, 10);
+		if (end != spec + 4 && *end == 0)
+			return new mem_user_store(n);
+	}
+	return NULL;
+}
+
+mysql_user_store::mysql_user_store(const string &url, const string &user, const string &password, const string &db, int port, unsigned int max_conn, unsigned int min_conn)
+	: m_connPool(connection_pool::GetInstance()), m_url(url), m_user(user), m_password(password), m_db(db),
+	  m_port(port), m_max_conn(max_conn), m_min_conn(min_conn), m_pool_started(false)
+{
+}
+
+//注册的预处理语句要在连接池init之前登记；连接池只init一次，连不上的连接由它的后台线程重连
+//失败时重试只会重新启动写注册的线程
+bool mysql_user_store::open()
+{
+	if (!m_pool_started)
+	{
+		user_batcher::GetInstance()->register_statements(m_connPool);
+		m_connPool->init(m_url, m_user, m_password, m_db, m_port, m_max_conn, m_min_conn);
+		m_pool_started = true;
+	}
+	return user_batcher::GetInstance()->start();
+}
+
+//要求user表有自增的id列，按id排序逐行从服务器取，不把整个结果集放进内存
+bool mysql_user_store::load(uint64_t cursor, user_loader fn, void *arg)
+{
+	//先从连接池中取一个连接
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	if (!mysql)
+	{
+		LOG_ERROR("%s", "load users failure: no database connection");
+		return false;
+	}
+
+	//在user表中检索游标之后的username，passwd数据
+	char sql[128];
+	snprintf(sql, sizeof(sql), "SELECT id,username,passwd FROM user WHERE id > %llu ORDER BY id", (unsigned long long)cursor);
+	if (mysql_query(mysql, sql))
+	{
+		LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+		return false;
+	}
+
+	MYSQL_RES *result = mysql_use_result(mysql);
+	if (!result)
+	{
+		LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+		return false;
+	}
+
+	while (MYSQL_ROW row = mysql_fetch_row(result))
+		fn(arg, strtoull(row[0], NULL, 10), row[1], row[2]);
+	bool ok = mysql_errno(mysql) == 0;
+	if (!ok)
+		LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+	mysql_free_result(result);
+	return ok;
+}
+
+bool mysql_user_store::submit(user_write *w)
+{
+	return user_batcher::GetInstance()->submit(w);
+}
+
+void mysql_user_store::close()
+{
+	user_batcher::GetInstance()->stop();
+}
+
+void mysql_user_store::dump_stats()
+{
+	m_connPool->dump_stats();
+	user_batcher::GetInstance()->dump_stats();
+}
+
+mem_user_store::mem_user_store(uint64_t n) : m_generated(n)
+{
+}
+
+//每个数据集一个快照文件
+string mem_user_store::snapshot_name() const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "user.mem%llu.snapshot", (unsigned long long)m_generated);
+	return name;
+}
+
+//生成的用户不占内存，按id现算出用户名和密码
+bool mem_user_store::load(uint64_t cursor, user_loader fn, void *arg)
+{
+	char name[32], password[32];
+	for (uint64_t id = cursor + 1; id <= m_generated; ++id)
+	{
+		snprintf(name, sizeof(name), "user%llu", (unsigned long long)id);
+		snprintf(password, sizeof(password), "pw%llu", (unsigned long long)id);
+		fn(arg, id, name, password);
+	}
+
+	uint64_t first = cursor < m_generated ? 0 : cursor - m_generated;
+	m_lock.lock();
+	vector<pair<string, string> > added(m_added.begin() + (first < m_added.size() ? first : m_added.size()), m_added.end());
+	m_lock.unlock();
+	for (size_t i = 0; i < added.size(); ++i)
+		fn(arg, m_generated + first + i + 1, added[i].first.c_str(), added[i].second.c_str());
+	return true;
+}
+
+//内存里记下就算持久化了，在提交方的线程里直接回调
+bool mem_user_store::submit(user_write *w)
+{
+	m_lock.lock();
+	m_added.push_back(make_pair(string(w->name), string(w->password)));
+	m_lock.unlock();
+	w->status = user_write::OK;
+	w->done(w);
+	return true;
+}
+
+void mem_user_store::dump_stats()
+{
+	m_lock.lock();
+	LOG_INFO("stats: mem user store %llu generated, %d registered", (unsigned long long)m_generated, (int)m_added.size());
+	m_lock.unlock();
+}
@@ -0,0 +1,108 @@
+#ifndef _USER_STORE_
+#define _USER_STORE_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//一条待写入的注册，name和password由提交方持有，done回调之前不能释放
+struct user_write
+{
+	enum
+	{
+		PENDING,
+		OK,		//已经持久化
+		FAILED, //写入失败
+		BUSY	//后端忙，没有提交
+	};
+
+	const char *name;
+	const char *password;
+	int status;
+	void (*done)(user_write *); //写入结束后调用，可能在submit返回之前、在提交方的线程里调用，之后不能再访问这条记录
+	void *arg;
+};
+
+//load读到一个用户时的回调
+typedef void (*user_loader)(void *arg, uint64_t id, const char *name, const char *password);
+
+// 用户数据的后端，启动时按命令行选择：
+//   mysql        MySQL，注册合并成多行INSERT写库(默认)
+//   mem:N        进程内生成N个确定的用户user1/pw1 … userN/pwN，注册只存在内存里，用于没有数据库的机器上压测和profile
+// 登录校验只查内存用户表(user_table)，后端只负责把用户读进来和持久化注册
+class user_store
+{
+public:
+	user_store() : m_data_dir(".") {}
+	virtual ~user_store() {}
+
+	//在后台线程里调用，可以阻塞，返回false表示后端不可用，调用方稍后再调用一次重试
+	virtual bool open() = 0;
+	//按id升序读id大于cursor的用户，返回false表示暂时读不了，已经回调的仍然有效，调用方稍后从最后一个id重试
+	virtual bool load(uint64_t cursor, user_loader fn, void *arg) = 0;
+	//任意线程调用，返回false表示没有提交，status为BUSY，不会回调
+	virtual bool submit(user_write *w) = 0;
+	//把已经提交的写完再返回
+	virtual void close() {}
+	virtual void dump_stats() {}
+	//快照等数据文件放在这个目录下，默认是当前目录，在open之前设置
+	void set_data_dir(const char *dir) { m_data_dir = dir; }
+	//这个后端对应的用户快照文件，不同的数据集不能共用
+	string snapshot_path() const { return m_data_dir + "/" + snapshot_name(); }
+
+	//按名字创建后端，名字不认识返回NULL
+	static user_store *create(const char *spec);
+
+protected:
+	//快照的文件名，不含目录
+	virtual string snapshot_name() const = 0;
+
+private:
+	string m_data_dir;
+};
+
+class connection_pool;
+
+class mysql_user_store : public user_store
+{
+public:
+	mysql_user_store(const string &url, const string &user, const string &password, const string &db, int port, unsigned int max_conn, unsigned int min_conn);
+	bool open();
+	bool load(uint64_t cursor, user_loader fn, void *arg);
+	bool submit(user_write *w);
+	void close();
+	void dump_stats();
+
+protected:
+	string snapshot_name() const { return "user.snapshot"; }
+
+private:
+	connection_pool *m_connPool;
+	string m_url, m_user, m_password, m_db;
+	int m_port;
+	unsigned int m_max_conn, m_min_conn;
+	bool m_pool_started;	//连接池已经init过，重试open时不再重复登记语句和建连接
+};
+
+class mem_user_store : public user_store
+{
+public:
+	mem_user_store(uint64_t n);
+	bool open() { return true; }
+	bool load(uint64_t cursor, user_loader fn, void *arg);
+	bool submit(user_write *w);
+	void dump_stats();
+
+protected:
+	string snapshot_name() const;
+
+private:
+	uint64_t m_generated;	//生成的用户数，id为1..m_generated
+	locker m_lock;
+	vector<pair<string, string> > m_added;	//运行中注册的用户，id从m_generated+1开始
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include <string.h>
+#include "user_table.h"
+
+using namespace std;
+
+user_table::entry user_table::s_tombstone;
+
+user_table::user_table()
+{
+	for (int i = 0; i < USER_TABLE_SHARDS; ++i)
+		m_shards[i].tab.store(new table(USER_TABLE_INIT_SLOTS), std::memory_order_relaxed);
+}
+
+user_table::~user_table()
+{
+	for (int i = 0; i < USER_TABLE_SHARDS; ++i)
+	{
+		shard &s = m_shards[i];
+		table *t = s.tab.load(std::memory_order_relaxed);
+		for (size_t j = 0; j <= t->mask; ++j)
+		{
+			entry *e = t->slots[j].load(std::memory_order_relaxed);
+			if (e && e != &s_tombstone)
+				delete e;
+		}
+		delete t;
+		for (size_t j = 0; j < s.retired_tables.size(); ++j)
+			delete s.retired_tables[j];
+		for (size_t j = 0; j < s.retired_entries.size(); ++j)
+			delete s.retired_entries[j];
+	}
+}
+
+//FNV-1a，高位选分片，低位选槽
+uint64_t user_table::hash(const char *name)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (const unsigned char *p = (const unsigned char *)name; *p; ++p)
+	{
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+//线性探测，遇到空槽结束；槽只会从空变成记录、从记录变成墓碑或新记录，读到的记录一定是完整的
+const user_table::entry *user_table::find(const char *name) const
+{
+	uint64_t h = hash(name);
+	const shard &s = m_shards[h >> (64 - USER_TABLE_SHARD_BITS)];
+	const table *t = s.tab.load(std::memory_order_acquire);
+	for (size_t i = h & t->mask;; i = (i + 1) & t->mask)
+	{
+		const entry *e = t->slots[i].load(std::memory_order_acquire);
+		if (!e)
+			return NULL;
+		if (e != &s_tombstone && e->hash == h && e->name == name)
+			return e;
+	}
+}
+
+bool user_table::check(const char *name, const char *password) const
+{
+	const entry *e = find(name);
+	if (e)
+		return e->password == password;
+	return m_base.check(name, hash(name), password);
+}
+
+bool user_table::contains(const char *name) const
+{
+	return find(name) != NULL || m_base.contains(name, hash(name));
+}
+
+int user_table::size() const
+{
+	int n = (int)m_base.size();
+	for (int i = 0; i < USER_TABLE_SHARDS; ++i)
+		n += m_shards[i].live.load(std::memory_order_relaxed);
+	return n;
+}
+
+bool user_table::insert(const char *name, const char *password, uint64_t id)
+{
+	uint64_t h = hash(name);
+	shard &s = m_shards[h >> (64 - USER_TABLE_SHARD_BITS)];
+	if (m_base.contains(name, h))
+		return false;
+
+	s.lock.lock();
+	//非空槽(含墓碑)超过一半就扩容，保证探测总能遇到空槽
+	if ((s.used + 1) * 2 > s.tab.load(std::memory_order_relaxed)->mask + 1)
+		grow(s);
+	table *t = s.tab.load(std::memory_order_relaxed);
+	std::atomic<entry *> *hole = NULL;
+	size_t i = h & t->mask;
+	for (;; i = (i + 1) & t->mask)
+	{
+		entry *e = t->slots[i].load(std::memory_order_relaxed);
+		if (!e)
+			break;
+		if (e == &s_tombstone)
+		{
+			if (!hole)
+				hole = &t->slots[i];
+		}
+		else if (e->hash == h && e->name == name)
+		{
+			//注册的用户写库后被增量读到，原地记下id，之后才会写进快照；查找不看id，不用换记录
+			if (id && !e->id.load(std::memory_order_relaxed))
+				e->id.store(id, std::memory_order_relaxed);
+			s.lock.unlock();
+			return false;
+		}
+	}
+	entry *e = new entry;
+	e->hash = h;
+	e->id.store(id, std::memory_order_relaxed);
+	e->name = name;
+	e->password = password;
+	if (hole)
+		hole->store(e, std::memory_order_release);     //复用墓碑，used不变
+	else
+	{
+		t->slots[i].store(e, std::memory_order_release);
+		++s.used;
+	}
+	s.live.fetch_add(1, std::memory_order_relaxed);
+	s.lock.unlock();
+	return true;
+}
+
+bool user_table::erase(const char *name)
+{
+	uint64_t h = hash(name);
+	shard &s = m_shards[h >> (64 - USER_TABLE_SHARD_BITS)];
+
+	s.lock.lock();
+	table *t = s.tab.load(std::memory_order_relaxed);
+	for (size_t i = h & t->mask;; i = (i + 1) & t->mask)
+	{
+		entry *e = t->slots[i].load(std::memory_order_relaxed);
+		if (!e)
+			break;
+		if (e != &s_tombstone && e->hash == h && e->name == name)
+		{
+			t->slots[i].store(&s_tombstone, std::memory_order_release);
+			s.retired_entries.push_back(e);     //读者可能还拿着它
+			s.live.fetch_sub(1, std::memory_order_relaxed);
+			s.lock.unlock();
+			return true;
+		}
+	}
+	s.lock.unlock();
+	return false;
+}
+
+bool user_table::open_snapshot(const char *path)
+{
+	return m_base.open(path);
+}
+
+//快照里的全部记录加上分片表里有id的记录，逐个分片加锁复制
+bool user_table::save_snapshot(const char *path, uint64_t cursor)
+{
+	user_snapshot::writer w;
+	bool ok = true;
+	m_base.for_each([&](const char *name, size_t name_len, const char *password, size_t password_len) {
+		string n(name, name_len);
+		ok = ok && w.add(name, name_len, hash(n.c_str()), password, password_len);
+	});
+	for (int i = 0; i < USER_TABLE_SHARDS && ok; ++i)
+	{
+		shard &s = m_shards[i];
+		s.lock.lock();
+		table *t = s.tab.load(std::memory_order_relaxed);
+		for (size_t j = 0; j <= t->mask && ok; ++j)
+		{
+			entry *e = t->slots[j].load(std::memory_order_relaxed);
+			uint64_t id = e && e != &s_tombstone ? e->id.load(std::memory_order_relaxed) : 0;
+			if (id && id <= cursor)
+				ok = w.add(e->name.data(), e->name.size(), e->hash, e->password.data(), e->password.size());
+		}
+		s.lock.unlock();
+	}
+	return ok && w.finish(path, cursor);
+}
+
+//持有分片的锁时调用，把记录搬到新表后一次性发布，墓碑不搬
+//活记录少于一半时原大小重建，只清墓碑
+void user_table::grow(shard &s)
+{
+	table *old = s.tab.load(std::memory_order_relaxed);
+	size_t n = old->mask + 1;
+	if ((size_t)s.live.load(std::memory_order_relaxed) * 4 >= n)
+		n *= 2;
+	table *t = new table(n);
+	size_t used = 0;
+	for (size_t i = 0; i <= old->mask; ++i)
+	{
+		entry *e = old->slots[i].load(std::memory_order_relaxed);
+		if (!e || e == &s_tombstone)
+			continue;
+		size_t j = e->hash & t->mask;
+		while (t->slots[j].load(std::memory_order_relaxed))
+			j = (j + 1) & t->mask;
+		t->slots[j].store(e, std::memory_order_relaxed);
+		++used;
+	}
+	s.tab.store(t, std::memory_order_release);
+	s.used = used;
+	s.retired_tables.push_back(old);
+}
@@ -0,0 +1,90 @@
+#ifndef _USER_TABLE_
+#define _USER_TABLE_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "../lock/locker.h"
+#include "user_snapshot.h"
+
+using namespace std;
+
+#define USER_TABLE_SHARD_BITS 6	//分片数的位数，用hash的最高几位选分片
+#define USER_TABLE_SHARDS (1 << USER_TABLE_SHARD_BITS)
+#define USER_TABLE_INIT_SLOTS 64	//每个分片开始的槽数，必须是2的幂
+
+// 登录校验用的用户表，读多写少：
+// 按用户名的hash分成USER_TABLE_SHARDS个分片，每个分片一张开放寻址的hash表，槽里放指向不可变记录的原子指针
+// 查找不加锁：原子地读表指针和槽，记录发布后除了id不再修改；插入和删除持有分片的锁，互不影响其他分片
+// 启动时可以先mmap一份磁盘快照(user_snapshot)作为只读的底层，查找先查分片表再查快照，分片表里只放快照之后新增的用户
+// 删除只把槽换成墓碑，表扩容时整张换新表，删掉的记录和旧表都不能马上释放(可能有读者还在看)，
+// 挂到分片的回收链上，析构时统一释放；只有注册写库失败才会删除，旧表按2倍增长，总共多占不到一倍
+// 注册的用户写库后读到id时原地原子地写id，不换记录，增量刷新不会让回收链变长
+class user_table
+{
+public:
+	user_table();
+	~user_table();
+
+	//在任何查找之前调用，之后快照只读
+	bool open_snapshot(const char *path);
+	uint64_t snapshot_cursor() const { return m_base.cursor(); }
+	//把快照和分片表里已经写进数据库(id不为0)的用户写成新快照，可以和查找、插入并发
+	bool save_snapshot(const char *path, uint64_t cursor);
+
+	//用户名已存在返回false；id是数据库里的id，注册时还没写库为0
+	//从数据库读到的用户已经以id为0在表里时，换成带id的记录，返回false
+	bool insert(const char *name, const char *password, uint64_t id = 0);
+	bool erase(const char *name);
+	//以下不加锁，任意线程随时调用
+	bool check(const char *name, const char *password) const;
+	bool contains(const char *name) const;
+	int size() const;
+
+private:
+	struct entry
+	{
+		uint64_t hash;
+		std::atomic<uint64_t> id;	//注册时为0，写库后读到id再填上，持有分片的锁时读写
+		string name;
+		string password;
+	};
+
+	struct table
+	{
+		table(size_t n) : mask(n - 1), slots(new std::atomic<entry *>[n])
+		{
+			for (size_t i = 0; i < n; ++i)
+				slots[i].store(NULL, std::memory_order_relaxed);
+		}
+		~table()
+		{
+			delete[] slots;
+		}
+		size_t mask;
+		std::atomic<entry *> *slots;
+	};
+
+	//每个分片独占缓存行，不同分片的写不会互相使对方的缓存失效
+	struct alignas(64) shard
+	{
+		shard() : tab(NULL), used(0), live(0) {}
+		std::atomic<table *> tab;
+		size_t used;    //非空的槽数，含墓碑，持有lock时访问
+		std::atomic<int> live;
+		locker lock;
+		vector<table *> retired_tables;
+		vector<entry *> retired_entries;
+	};
+
+	static uint64_t hash(const char *name);
+	const entry *find(const char *name) const;
+	void grow(shard &s);
+
+	static entry s_tombstone;
+	user_snapshot m_base;
+	shard m_shards[USER_TABLE_SHARDS];
+};
+
+#endif
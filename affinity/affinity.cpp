@@ -0,0 +1,138 @@
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "affinity.h"
+
+//linux/mempolicy.h里的内存策略
+#define MPOL_DEFAULT 0
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+
+#define MAX_NODES (8 * sizeof(unsigned long)) //节点掩码用一个unsigned long，最多64个节点
+
+bool parse_cpu_list(const char *str, std::vector<int> &cpus)
+{
+    cpus.clear();
+    const char *p = str;
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((int)cpu);
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            return false;
+        else
+            break;
+    }
+    return !cpus.empty();
+}
+
+bool pin_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+//sysfs里cpuN目录下有一个nodeM的链接
+int cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+    int node = -1;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9')
+        {
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+//在线节点的掩码，读不到时当作只有节点0
+static unsigned long online_node_mask()
+{
+    unsigned long mask = 1;
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (!fp)
+        return mask;
+    char buf[256];
+    std::vector<int> nodes;
+    if (fgets(buf, sizeof(buf), fp) && parse_cpu_list(buf, nodes))
+    {
+        mask = 0;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (nodes[i] < (int)MAX_NODES)
+                mask |= 1UL << nodes[i];
+        }
+    }
+    fclose(fp);
+    return mask ? mask : 1;
+}
+
+int numa_nodes()
+{
+    return __builtin_popcountl(online_node_mask());
+}
+
+void *numa_alloc_interleaved(size_t size)
+{
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    unsigned long mask = online_node_mask();
+    //页还没有被写过，设置策略后第一次写入时才按策略分配；失败了就是普通的本地分配
+    if (__builtin_popcountl(mask) > 1)
+        syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, &mask, MAX_NODES, 0);
+    return addr;
+}
+
+void numa_free(void *addr, size_t size)
+{
+    if (addr)
+        munmap(addr, size);
+}
+
+numa_scope::numa_scope(int node) : m_set(false)
+{
+    if (node < 0 || node >= (int)MAX_NODES || numa_nodes() <= 1)
+        return;
+    unsigned long mask = 1UL << node;
+    m_set = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MAX_NODES) == 0;
+}
+
+numa_scope::~numa_scope()
+{
+    if (m_set)
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+}
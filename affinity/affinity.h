@@ -0,0 +1,62 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <vector>
+#include <new>
+#include <stddef.h>
+
+// 线程绑核和NUMA内存放置，直接用sched/mbind/set_mempolicy系统调用，不依赖libnuma
+// 单节点的机器上内存策略相关的调用都是空操作
+
+//解析"0-3,8,10-11"这样的CPU列表，格式错误返回false
+bool parse_cpu_list(const char *str, std::vector<int> &cpus);
+
+//把调用线程绑到指定的CPU上
+bool pin_thread(int cpu);
+
+//CPU所在的NUMA节点，不知道时返回-1
+int cpu_node(int cpu);
+
+//在线的NUMA节点数
+int numa_nodes();
+
+//按页在所有在线节点之间交错分配，适合被所有线程访问、又没法按线程划分的大数组
+void *numa_alloc_interleaved(size_t size);
+void numa_free(void *addr, size_t size);
+
+// 在作用域内让本线程新分配的内存优先放在node上，离开作用域恢复默认的本地分配
+// 主线程替别的线程分配结构时用：结构里的页在构造时被写到，也就落在了使用它的线程所在的节点上
+class numa_scope
+{
+public:
+    explicit numa_scope(int node);
+    ~numa_scope();
+
+private:
+    bool m_set;
+};
+
+//交错分配并构造n个T，配合numa_delete_array释放
+template <typename T>
+T *numa_new_array(size_t n)
+{
+    void *addr = numa_alloc_interleaved(n * sizeof(T));
+    if (!addr)
+        return NULL;
+    T *array = (T *)addr;
+    for (size_t i = 0; i < n; ++i)
+        new (array + i) T();
+    return array;
+}
+
+template <typename T>
+void numa_delete_array(T *array, size_t n)
+{
+    if (!array)
+        return;
+    for (size_t i = 0; i < n; ++i)
+        array[i].~T();
+    numa_free(array, n * sizeof(T));
+}
+
+#endif
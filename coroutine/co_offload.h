@@ -0,0 +1,79 @@
+#ifndef CO_OFFLOAD_H
+#define CO_OFFLOAD_H
+
+#include <coroutine>
+#include "co_scheduler.h"
+#include "../threadpool/threadpool.h"
+
+// 交给阻塞线程池执行的一段工作，满足threadpool对任务类型的要求
+// 嵌在offload_awaiter里，跟着协程帧走，不需要另外分配
+// 执行完把协程post回它所属的reactor，之后不能再访问自己：协程恢复后帧可能已经销毁
+struct co_job
+{
+    co_job() : m_worker(-1), m_lane(0), m_queued_at(0), fn(NULL), arg(NULL), sched(NULL), ok(false) {}
+
+    bool process()
+    {
+        fn(arg);
+        ok = true;
+        sched->post(handle);
+        return true;
+    }
+
+    //排队太久被线程池丢弃，不执行，带着失败恢复协程
+    void shed()
+    {
+        ok = false;
+        sched->post(handle);
+    }
+
+    int m_worker;
+    int m_lane;
+    long long m_queued_at;
+    void (*fn)(void *);
+    void *arg;
+    co_scheduler *sched;
+    std::coroutine_handle<> handle;
+    bool ok;
+};
+
+typedef threadpool<co_job> co_executor;
+
+// co_await co_offload(executor, sched, fn)：在阻塞线程池里执行fn，完成后回到sched所属的reactor线程继续
+// 结果通过fn捕获的引用带回，co_await的值表示fn是否执行了(线程池满或排队超时为false)
+template <typename F>
+class offload_awaiter
+{
+public:
+    offload_awaiter(co_executor *executor, co_scheduler *sched, F fn) : m_executor(executor), m_fn(fn)
+    {
+        m_job.fn = &offload_awaiter::call;
+        m_job.arg = this;
+        m_job.sched = sched;
+    }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        m_job.handle = h;
+        return m_executor->append(&m_job);    //入队失败不挂起，直接带着false继续
+    }
+    bool await_resume() const noexcept { return m_job.ok; }
+
+private:
+    static void call(void *arg)
+    {
+        ((offload_awaiter *)arg)->m_fn();
+    }
+
+    co_executor *m_executor;
+    F m_fn;
+    co_job m_job;
+};
+
+template <typename F>
+offload_awaiter<F> co_offload(co_executor *executor, co_scheduler *sched, F fn)
+{
+    return offload_awaiter<F>(executor, sched, fn);
+}
+
+#endif
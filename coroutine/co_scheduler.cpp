@@ -0,0 +1,110 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "co_scheduler.h"
+
+void co_scheduler::init(int epollfd, int wakefd, int max_fd)
+{
+    m_epollfd = epollfd;
+    m_wakefd = wakefd;
+    m_max_fd = max_fd;
+    m_waiters.assign(max_fd, NULL);
+    m_cancelled.assign(max_fd, 0);
+}
+
+//先放进就绪列表再写eventfd，reactor读到eventfd时一定能看到这个协程
+void co_scheduler::post(std::coroutine_handle<> h)
+{
+    m_lock.lock();
+    m_ready.push_back(h);
+    m_lock.unlock();
+    uint64_t one = 1;
+    ssize_t n = write(m_wakefd, &one, sizeof(one));
+    (void)n;
+}
+
+//整批取出再恢复，协程恢复后又post的会留到下一次eventfd
+void co_scheduler::run_ready()
+{
+    m_lock.lock();
+    m_running.swap(m_ready);
+    m_lock.unlock();
+    for (size_t i = 0; i < m_running.size(); ++i)
+        m_running[i].resume();
+    m_running.clear();
+}
+
+//fd已经在epoll上就MOD，否则ADD，都是EPOLLONESHOT，就绪一次后由等待方决定是否再等
+//fd已经被取消的返回false，等待方不会挂起
+bool co_scheduler::watch_fd(int fd, uint32_t events, fd_waiter *waiter)
+{
+    if (fd < 0 || fd >= m_max_fd || m_cancelled[fd])
+        return false;
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = events | EPOLLONESHOT | EPOLLRDHUP;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event) < 0 &&
+        (errno != ENOENT || epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) < 0))
+        return false;
+    m_waiters[fd] = waiter;
+    return true;
+}
+
+void co_scheduler::wake_fd(int fd, uint32_t revents)
+{
+    if (!has_waiter(fd))
+        return;
+    fd_waiter *waiter = m_waiters[fd];
+    m_waiters[fd] = NULL;
+    waiter->on_ready(revents);
+}
+
+//不再等这个fd，由等待方决定怎么收尾
+//现在没有人在等(协程还没开始或者在别处挂着)就记下来，之后再等这个fd马上失败，取消不会丢
+void co_scheduler::cancel_fd(int fd)
+{
+    if (fd < 0 || fd >= m_max_fd)
+        return;
+    if (!has_waiter(fd))
+    {
+        m_cancelled[fd] = 1;
+        return;
+    }
+    fd_waiter *waiter = m_waiters[fd];
+    m_waiters[fd] = NULL;
+    waiter->on_cancel();
+}
+
+//fd关闭之前调用，清掉取消标记，这个fd号复用时从头开始
+void co_scheduler::release_fd(int fd)
+{
+    if (fd >= 0 && fd < m_max_fd)
+    {
+        m_waiters[fd] = NULL;
+        m_cancelled[fd] = 0;
+    }
+}
+
+bool co_scheduler::fd_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    m_handle = h;
+    if (!m_sched->watch_fd(m_fd, m_events, this))
+    {
+        m_revents = EPOLLERR;
+        return false;
+    }
+    return true;
+}
+
+void co_scheduler::fd_awaiter::on_ready(uint32_t revents)
+{
+    m_revents = revents;
+    m_handle.resume();
+}
+
+//协程稍后在run_ready里带着EPOLLERR恢复，不在调用方的栈上直接恢复
+void co_scheduler::fd_awaiter::on_cancel()
+{
+    m_revents = EPOLLERR;
+    m_sched->post(m_handle);
+}
@@ -0,0 +1,76 @@
+#ifndef CO_SCHEDULER_H
+#define CO_SCHEDULER_H
+
+#include <coroutine>
+#include <vector>
+#include <stdint.h>
+#include "../lock/locker.h"
+
+//fd就绪时的回调，由reactor线程调用
+class fd_waiter
+{
+public:
+    virtual ~fd_waiter() {}
+    virtual void on_ready(uint32_t revents) = 0;
+    virtual void on_cancel() {}     //默认不能取消，等它自己完成
+};
+
+// 每个reactor一个，负责在reactor线程里恢复协程
+// 其他线程用post()把要恢复的协程交过来，写eventfd唤醒reactor，reactor在wakefd可读时调用run_ready()
+// 协程也可以co_await wait_fd()等一个fd可读写，fd注册在reactor的epoll上，就绪时由reactor调用wake_fd()恢复
+class co_scheduler
+{
+public:
+    //等fd就绪的awaiter，co_await的结果是epoll返回的事件，被取消时为EPOLLERR
+    class fd_awaiter : public fd_waiter
+    {
+    public:
+        fd_awaiter(co_scheduler *sched, int fd, uint32_t events) : m_sched(sched), m_fd(fd), m_events(events), m_revents(0) {}
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        uint32_t await_resume() const noexcept { return m_revents; }
+        void on_ready(uint32_t revents);
+        void on_cancel();
+
+    private:
+        co_scheduler *m_sched;
+        int m_fd;
+        uint32_t m_events;
+        uint32_t m_revents;
+        std::coroutine_handle<> m_handle;
+    };
+
+public:
+    co_scheduler() : m_epollfd(-1), m_wakefd(-1), m_max_fd(0) {}
+    void init(int epollfd, int wakefd, int max_fd);
+
+    //任意线程调用
+    void post(std::coroutine_handle<> h);
+
+    //以下只在reactor线程调用
+    void run_ready();
+    fd_awaiter wait_fd(int fd, uint32_t events)
+    {
+        return fd_awaiter(this, fd, events);
+    }
+    bool has_waiter(int fd) const
+    {
+        return fd >= 0 && fd < m_max_fd && m_waiters[fd] != NULL;
+    }
+    bool watch_fd(int fd, uint32_t events, fd_waiter *waiter);
+    void wake_fd(int fd, uint32_t revents);
+    void cancel_fd(int fd);
+    void release_fd(int fd);
+
+private:
+    int m_epollfd;
+    int m_wakefd;
+    int m_max_fd;
+    std::vector<fd_waiter *> m_waiters;     //以fd为下标，只被reactor线程访问
+    std::vector<char> m_cancelled;          //以fd为下标，取消时还没有人在等，之后的watch_fd直接失败，直到release_fd
+    locker m_lock;
+    std::vector<std::coroutine_handle<> > m_ready;  //其他线程交过来待恢复的协程
+    std::vector<std::coroutine_handle<> > m_running;
+};
+
+#endif
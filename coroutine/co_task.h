@@ -0,0 +1,51 @@
+#ifndef CO_TASK_H
+#define CO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include "co_scheduler.h"
+
+// 请求处理协程的返回类型
+// 创建后先挂起，start()把它交给连接所属reactor的co_scheduler，由reactor线程开始执行
+// 之后每次co_await挂起都由reactor恢复，执行完协程帧自己销毁，调用方不需要再管它
+class co_task
+{
+public:
+    struct promise_type
+    {
+        co_task get_return_object()
+        {
+            return co_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit co_task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+    co_task(co_task &&other) noexcept : m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+    co_task(const co_task &) = delete;
+    co_task &operator=(const co_task &) = delete;
+
+    //没有start过的协程在这里销毁
+    ~co_task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    void start(co_scheduler *sched)
+    {
+        sched->post(m_handle);
+        m_handle = nullptr;
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+#endif
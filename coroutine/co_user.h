@@ -0,0 +1,49 @@
+#ifndef CO_USER_H
+#define CO_USER_H
+
+#include <coroutine>
+#include "co_scheduler.h"
+#include "../CGImysql/user_store.h"
+
+// co_await co_register_user(store, sched, name, password)：把一条注册交给用户数据的后端，协程挂起到写入结束
+// 后端回调时把协程post回sched所属的reactor(后端可能在submit里直接回调，这时协程已经挂起，同样post)，co_await的结果是user_write::OK/FAILED/BUSY
+// name和password要在co_await期间保持有效，放在协程帧里即可
+class register_awaiter
+{
+public:
+    register_awaiter(user_store *store, co_scheduler *sched, const char *name, const char *password) : m_store(store), m_sched(sched)
+    {
+        m_write.name = name;
+        m_write.password = password;
+        m_write.status = user_write::PENDING;
+        m_write.done = &register_awaiter::done;
+        m_write.arg = this;
+    }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        m_handle = h;
+        return m_store->submit(&m_write);   //后端忙不挂起，直接带着BUSY继续
+    }
+    int await_resume() const noexcept { return m_write.status; }
+
+private:
+    //post之后协程随时可能恢复并销毁自己的帧，不能再访问this
+    static void done(user_write *w)
+    {
+        register_awaiter *self = (register_awaiter *)w->arg;
+        self->m_sched->post(self->m_handle);
+    }
+
+    user_store *m_store;
+    co_scheduler *m_sched;
+    std::coroutine_handle<> m_handle;
+    user_write m_write;
+};
+
+inline register_awaiter co_register_user(user_store *store, co_scheduler *sched, const char *name, const char *password)
+{
+    return register_awaiter(store, sched, name, password);
+}
+
+#endif
@@ -1,10 +1,10 @@
 #include "http_conn.h"
 #include "../log/log.h"
-#include <map>
+#include "../CGImysql/user_table.h"
+#include "http_scan.h"
 #include <mysql/mysql.h>
 #include <fstream>
-
-extern unordered_map<int, SSL*> fd2ssl;
+#include <limits.h>
 
 //#define connfdET //边缘触发非阻塞
 #define connfdLT //水平触发阻塞
@@ -22,44 +22,66 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is overloaded, please try again later.\n";
 
 //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
 //  const char *doc_root = "/root/vscode/TinyWebServer-raw_version/root";
 const char *doc_root = "/root/myblog/public";
 
-//将表中的用户名和密码放入map
-map<string, string> users;
-locker m_lock;
+//将表中的用户名和密码放入内存表，登录校验不加锁地查它
+static user_table users;
+
 
+user_store *http_conn::m_store = NULL;
+co_executor *http_conn::m_offload = NULL;
+std::atomic<bool> http_conn::m_db_ready(false);
+uint64_t http_conn::m_user_cursor = 0;
+session_store http_conn::m_sessions;
 
-void http_conn::initmysql_result(connection_pool *connPool)
+//load读到一个用户，放进内存表并推进游标
+static void load_user(void *arg, uint64_t id, const char *name, const char *password)
 {
-    //先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
+    users.insert(name, password, id);
+    http_conn::m_user_cursor = id;
+    ++*(int *)arg;
+}
 
-    //在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
+//从后端读入用户，返回false表示后端暂时不可用，调用方稍后重试
+//第一次调用先mmap用户快照，之后只读id大于游标的新用户，再次调用就是增量刷新
+//快照之后在数据库里改密码或删掉的用户读不到，需要删掉快照文件重新全量读
+bool http_conn::load_users()
+{
+    static bool snapshot_tried = false;
+    string path = m_store->snapshot_path();
+    if (!snapshot_tried)
     {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        snapshot_tried = true;
+        if (users.open_snapshot(path.c_str()))
+        {
+            m_user_cursor = users.snapshot_cursor();
+            LOG_INFO("user snapshot %s: %d user(s), cursor %llu", path.c_str(), users.size(), (unsigned long long)m_user_cursor);
+        }
     }
 
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+    //中途出错时游标停在读到的最后一个用户
+    int loaded = 0;
+    bool ok = m_store->load(m_user_cursor, load_user, &loaded);
+    if (loaded)
+        LOG_INFO("loaded %d user(s), %d in total, cursor %llu", loaded, users.size(), (unsigned long long)m_user_cursor);
+    return ok;
+}
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+//快照落后于后端时写一份新的，下次启动直接mmap；在后台线程调用，写的时候登录注册照常
+void http_conn::save_users()
+{
+    string path = m_store->snapshot_path();
+    if (m_user_cursor <= users.snapshot_cursor())
+        return;
+    if (users.save_snapshot(path.c_str(), m_user_cursor))
+        LOG_INFO("user snapshot %s saved, cursor %llu", path.c_str(), (unsigned long long)m_user_cursor);
+    else
+        LOG_ERROR("user snapshot %s save failure", path.c_str());
 }
 
 //对文件描述符设置非阻塞
@@ -123,88 +145,170 @@ void modfd(int epollfd, int fd, int ev)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
 
 //关闭连接，关闭一个连接，客户总量减一
+//调用前要先把定时器从时间轮上摘下；fd一关，别的reactor就可能accept到同一个fd，重新初始化users[fd]和users_timer[fd]，
+//所以先释放SSL、清掉连接状态，最后才close
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
-        removefd(m_epollfd, m_sockfd);
+        if (m_ssl)
+        {
+            if (!m_handshaking)
+                SSL_shutdown(m_ssl);    //非阻塞地发一次close_notify，不等对端回应
+            SSL_free(m_ssl);
+            m_ssl = NULL;
+        }
+        int fd = m_sockfd;
         m_sockfd = -1;
         m_user_count--;
+        m_sched->release_fd(fd);    //协程取消的标记不能留给复用这个fd的新连接
+        removefd(m_epollfd, fd);
     }
 }
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, SSL *ssl, co_scheduler *sched)
 {
+    m_epollfd = epollfd;
+    m_sched = sched;    //连接上的协程都在这个reactor里恢复
     m_sockfd = sockfd;
+    m_ssl = ssl;    //SSL对象归连接所有，在close_conn中释放
+    m_worker = -1;  //新连接还没有绑定工作线程
     m_address = addr;
     //int reuse=1;
     //setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
     addfd(m_epollfd, sockfd, true);
     m_user_count++;
+    m_handshaking = true;   //新连接先完成TLS握手，再进入http状态机
     init();
 }
 
-//初始化新接受的连接
+//非阻塞地推进TLS握手，由reactor在EPOLLIN/EPOLLOUT上反复调用，直到握手完成或出错
+//握手未完成时按OpenSSL的要求重新注册读或写事件，不在事件循环里阻塞等待对端
+http_conn::HANDSHAKE_STATUS http_conn::do_handshake()
+{
+    ERR_clear_error();  //SSL_get_error要看线程的错误队列，先清掉同一线程上别的连接留下的错误
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret == 1)
+    {
+        m_handshaking = false;
+        modfd(m_epollfd, m_sockfd, EPOLLIN);    //握手完成，开始等待http请求
+        return HANDSHAKE_OK;
+    }
+    int err = SSL_get_error(m_ssl, ret);
+    if (err == SSL_ERROR_WANT_READ)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        return HANDSHAKE_AGAIN;
+    }
+    if (err == SSL_ERROR_WANT_WRITE)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+        return HANDSHAKE_AGAIN;
+    }
+    LOG_ERROR("ssl handshake failed on fd %d, ssl error %d", m_sockfd, err);
+    return HANDSHAKE_ERROR;
+}
+
+//初始化新接受的连接，上一个连接没发完的响应直接丢掉
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
     mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    unmap();
+    clear_responses();
+    m_read_idx = 0;
+    m_request_end = 0;
+    m_indexed_idx = READ_BUFFER_SIZE;   //上一个连接留下的位图整个清掉
+    next_request();
+}
+
+//一个请求的响应排进发送队列后调用：把读缓冲区里这个请求后面的字节(流水线上的下一个请求)挪到开头，
+//解析状态回到请求行；只动下标，不清空缓冲区，解析只看m_read_idx以内的字节
+void http_conn::next_request()
+{
+    assert(m_request_end >= 0 && m_request_end <= m_read_idx);
+    int left = m_read_idx - m_request_end;
+    if (left > 0 && m_request_end > 0)
+        memmove(m_read_buf, m_read_buf + m_request_end, left);
+    m_read_idx = left > 0 ? left : 0;
+    m_request_end = 0;
+    //挪过的字节位置变了，下次解析时重新建索引；置过位的只有m_indexed_idx之前的字
+    memset(m_delims, 0, (m_indexed_idx + 63) / 64 * sizeof(uint64_t));
+    m_indexed_idx = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
-    m_host = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
     cgi = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    m_string = 0;
+    m_lane = LANE_STATIC;
+    m_headers.reset(m_read_buf);
+    m_new_sid[0] = '\0';
+}
+
+//一批响应发完或者连接出错，解除文件映射，发送队列清空
+void http_conn::clear_responses()
+{
+    for (int i = 0; i < m_mapped_count; ++i)
+        munmap(m_mapped[i].iov_base, m_mapped[i].iov_len);
+    m_mapped_count = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_responses = 0;
+    m_write_idx = 0;
+    bytes_to_send = 0;
+    m_keep_alive = false;
+}
+
+//[from, to)里第一个a或b的位置，没有返回to；新读进来的字节先建索引，每个字节只扫一遍
+int http_conn::find_delim(int from, int to, char a, char b)
+{
+    if (m_indexed_idx < m_read_idx)
+    {
+        http_index(m_read_buf, m_indexed_idx, m_read_idx, m_delims);
+        m_indexed_idx = m_read_idx;
+    }
+    return http_find(m_read_buf, m_delims, from, to, a, b);
 }
 
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK(一行完整),LINE_BAD(语法有误),LINE_OPEN(行不完整)
+//每一行都是以\r\n结尾的，按位图跳到下一个\r或\n，完整的话把\r\n转为\0\0
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) // 读所有字符，每一行都是以\r\n结尾的，拿这个判断行是否完整，完整的话把\r\n转为\0\0
+    if (m_checked_idx >= m_read_idx)
+        return LINE_OPEN;
+    m_checked_idx = find_delim(m_checked_idx, m_read_idx, '\r', '\n');
+    if (m_checked_idx == m_read_idx)
+        return LINE_OPEN;
+    if (m_read_buf[m_checked_idx] == '\r')
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;   //下次从这个\r接着查
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            if ((m_checked_idx + 1) == m_read_idx) 
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        else if (temp == '\n')  //直接读到\n
-        {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
+    }
+    //直接读到\n
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
     }
-    return LINE_OPEN;
+    return LINE_BAD;
 }
 
 //循环读取客户数据，直到无数据可读或对方关闭连接
@@ -220,13 +324,19 @@ bool http_conn::read_once()
 #ifdef connfdLT
 
     // bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-    bytes_read = SSL_read(fd2ssl[m_sockfd], m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
-    m_read_idx += bytes_read;
+    ERR_clear_error();
+    bytes_read = SSL_read(m_ssl, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
 
     if (bytes_read <= 0)
     {
+        //socket非阻塞，可读事件可能只带来半条TLS记录，这时SSL_read返回WANT_READ，不是出错
+        //交给process()，请求不完整时它会重新注册读事件
+        int err = SSL_get_error(m_ssl, bytes_read);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+            return true;
         return false;
     }
+    m_read_idx += bytes_read;
 
     return true;
 
@@ -252,20 +362,43 @@ bool http_conn::read_once()
 #endif
 }
 
-//解析http请求行，获得请求方法，目标url及http版本号
-http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
+//就地规整url：连续的/合成一个，有.或..的路径段返回false
+//要登录的页面按url原样比较，//welcome.html、/./welcome.html这样的写法不能绕过去，..也不能跑出doc_root
+static bool normalize_url(char *url)
 {
-    m_url = strpbrk(text, " \t");   //检索text中最先含有空格或者tab任一时，返回该位置
-    if (!m_url)
+    char *dst = url;
+    const char *src = url;
+    while (*src)
     {
-        return BAD_REQUEST;
+        while (*src == '/')
+            ++src;
+        size_t n = strcspn(src, "/");
+        if ((n == 1 && src[0] == '.') || (n == 2 && src[0] == '.' && src[1] == '.'))
+            return false;
+        *dst++ = '/';
+        memmove(dst, src, n);
+        dst += n;
+        src += n;
     }
-    *m_url++ = '\0';    //text的GET或者POST用\0隔开，截断前面的，把剩余部分存在m_url里面
+    *dst = '\0';
+    return true;
+}
 
-    char *method = text;
-    if (strcasecmp(method, "GET") == 0) //忽略大小写比较字符串，相等返回0
+//解析http请求行，获得请求方法，目标url及http版本号，len是行的长度
+//空白的位置从位图里取，方法和版本按长度比较，不再把这一行重新扫一遍
+http_conn::HTTP_CODE http_conn::parse_request_line(char *text, int len)
+{
+    int start = text - m_read_buf, end = start + len;
+    int sp = find_delim(start, end, ' ', '\t');   //第一个空格或者tab的位置
+    if (sp == end)
+    {
+        return BAD_REQUEST;
+    }
+    int method_len = sp - start;
+    m_read_buf[sp] = '\0';   //text的GET或者POST用\0隔开，截断前面的，把剩余部分存在m_url里面
+    if (method_len == 3 && strncasecmp(text, "GET", 3) == 0)  //忽略大小写比较字符串，相等返回0
         m_method = GET;
-    else if (strcasecmp(method, "POST") == 0)
+    else if (method_len == 4 && strncasecmp(text, "POST", 4) == 0)
     {
         m_method = POST;
         cgi = 1;
@@ -273,14 +406,20 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     else
         return BAD_REQUEST;
 
-    m_url += strspn(m_url, " \t");  //去除前面的多余空格或tab
-    m_version = strpbrk(m_url, " \t");  // 找到version的位置
-    if (!m_version)
+    int url = sp + 1;
+    while (url < end && (m_read_buf[url] == ' ' || m_read_buf[url] == '\t'))  //去除前面的多余空格或tab
+        ++url;
+    sp = find_delim(url, end, ' ', '\t');  // 找到version的位置
+    if (sp == end)
         return BAD_REQUEST;
-    *m_version++ = '\0';    //截断url和version
-    m_version += strspn(m_version, " \t");
-
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) //只支持HTTP1.1
+    m_read_buf[sp] = '\0';   //截断url和version
+    int version = sp + 1;
+    while (version < end && (m_read_buf[version] == ' ' || m_read_buf[version] == '\t'))
+        ++version;
+    m_url = m_read_buf + url;
+    m_version = m_read_buf + version;
+
+    if (end - version != 8 || strncasecmp(m_version, "HTTP/1.1", 8) != 0) //只支持HTTP1.1
         return BAD_REQUEST;
     if (strncasecmp(m_url, "http://", 7) == 0)  //忽略http://
     {
@@ -294,7 +433,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_url = strchr(m_url, '/');
     }
 
-    if (!m_url || m_url[0] != '/')
+    if (!m_url || m_url[0] != '/' || !normalize_url(m_url))
         return BAD_REQUEST;
     //当url为/时，给url后面补"judge.html",以显示判断界面
     // if (strlen(m_url) == 1)
@@ -305,44 +444,55 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     return NO_REQUEST;
 }
 
-//解析http请求的一个头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char *text)
+//解析http请求的一个头部信息，len是行的长度
+//找到冒号后名字交给完美hash查编号，名字和值都只记位置放进请求头表，解析时只处理影响报文读取的几个
+http_conn::HTTP_CODE http_conn::parse_headers(char *text, int len)
 {
-    if (text[0] == '\0')    //请求头可能是空的，也可能是报文空行
+    if (len == 0)    //请求头可能是空的，也可能是报文空行
     {
         if (m_content_length != 0)  //content有内容
         {
+            if (m_content_length > READ_BUFFER_SIZE - m_checked_idx)
+                return BAD_REQUEST;     //报文体在读缓冲区里放不下
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;  // 请求不完整，需要继续读取报文
         }
+        m_request_end = m_checked_idx;
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    int start = text - m_read_buf;
+    int name_len = find_delim(start, start + len, ':', ':') - start;
+    if (name_len == len || name_len == 0)
+        return NO_REQUEST;  //没有名字的行不要
+    char *value = text + name_len + 1, *end = text + len;
+    while (value < end && (*value == ' ' || *value == '\t'))
+        ++value;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+    switch (m_headers.add(text, name_len, value, end - value))
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+    case HDR_CONNECTION:
+        m_linger = (end - value == 10 && strncasecmp(value, "keep-alive", 10) == 0);
+        break;
+    case HDR_CONTENT_LENGTH:
+    {
+        //只认十进制数字，负数、空值和读缓冲区放不下的长度都是坏请求，不然m_request_end会越过m_read_idx
+        if (value == end)
+            return BAD_REQUEST;
+        long n = 0;
+        for (const char *p = value; p < end; ++p)
         {
-            m_linger = true;
+            if (*p < '0' || *p > '9')
+                return BAD_REQUEST;
+            n = n * 10 + (*p - '0');
+            if (n > READ_BUFFER_SIZE)
+                return BAD_REQUEST;
         }
+        m_content_length = n;
+        break;
     }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }
-    else if (strncasecmp(text, "Host:", 5) == 0)
-    {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
-    else
-    {
-        //printf("oop!unknow header: %s\n",text);
-        //LOG_INFO("oop!unknow header: %s", text);
-        Log::get_instance()->flush();
+    default:
+        break;
     }
     return NO_REQUEST;
 }
@@ -352,9 +502,9 @@ http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
+        //POST请求中最后为输入的用户名和密码，长度是m_content_length，后面紧接着可能是下一个请求，不能写\0
         m_string = text;
+        m_request_end = m_checked_idx + m_content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -371,27 +521,44 @@ http_conn::HTTP_CODE http_conn::process_read()
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
         text = get_line();  // char* 以\0结尾，所以只读一行
+        int len = m_checked_idx - 2 - m_start_line; //行的长度，不含\r\n；报文体不按行解析，用不到
         m_start_line = m_checked_idx;   //startline就是get_line的起始位置，读完了现在更新一下
 
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        //报文体不以\0结尾，里面还有明文密码，不写日志
+        if (m_check_state != CHECK_STATE_CONTENT)
+        {
+            LOG_INFO("%s", text);
+            Log::get_instance()->flush();
+        }
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
         {
-            ret = parse_request_line(text); // 把请求行的三个信息读到m_method,m_url,m_version里面
+            ret = parse_request_line(text, len); // 把请求行的三个信息读到m_method,m_url,m_version里面
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
+            //请求行解析完就知道是不是登录注册，交给协程或者换到数据库lane，不占静态请求的线程
+            if (m_lane == LANE_STATIC && cgi_flag())
+            {
+                if (!m_db_ready.load(std::memory_order_acquire))
+                    return SERVICE_UNAVAILABLE;     //还在启动，静态文件照常服务
+#ifdef CO_HANDLER
+                return COROUTINE_REQUEST;
+#else
+                m_lane = LANE_DB;
+                return REQUEUE_REQUEST;
+#endif
+            }
             break;
         }
         case CHECK_STATE_HEADER:
         {
-            ret = parse_headers(text);
+            ret = parse_headers(text, len);
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
-                return do_request();    //文件地址赋值给了m_file_address
+                return m_co ? GET_REQUEST : do_request();    //文件地址赋值给了m_file_address；协程处理的请求由协程自己接着做
             }
             break;
         }
@@ -399,7 +566,7 @@ http_conn::HTTP_CODE http_conn::process_read()
         {
             ret = parse_content(text);
             if (ret == GET_REQUEST) // 如果获得了完整的HTTP请求
-                return do_request();    //文件地址赋值给了m_file_address，完成请求资源映射
+                return m_co ? GET_REQUEST : do_request();    //文件地址赋值给了m_file_address，完成请求资源映射
             line_status = LINE_OPEN;
             break;
         }
@@ -412,156 +579,167 @@ http_conn::HTTP_CODE http_conn::process_read()
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);  //拼接文件的绝对地址
-    int len = strlen(doc_root);
     printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');    //找到最后一次出现 / 的地址给p
-/************************************
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        //同步线程登录校验
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
 
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
-    }
-    else if (*(p + 1) == 'i')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/index.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    //处理cgi，登录和注册是表单POST到/2CGISQL.cgi和/3CGISQL.cgi，结果是要返回的页面
+    const char *url = m_url;
+    char flag = cgi_flag();
+    if (flag)
+        url = do_cgi(flag);
+    else
+        url = auth_page(url);
+    return map_file(url);
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '5')
+//登录后才能看的页面，welcome.html上的表单POST到5、6、7
+static const char *const auth_pages[][2] = {
+    {"/welcome.html", "/welcome.html"},
+    {"/picture.html", "/picture.html"},
+    {"/video.html", "/video.html"},
+    {"/fans.html", "/fans.html"},
+    {"/5", "/picture.html"},
+    {"/6", "/video.html"},
+    {"/7", "/fans.html"}};
+
+//要登录的页面有有效会话就返回对应的页面，没有就换成登录页面；其他url原样返回
+const char *http_conn::auth_page(const char *url)
+{
+    for (size_t i = 0; i < sizeof(auth_pages) / sizeof(auth_pages[0]); ++i)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        if (strcmp(url, auth_pages[i][0]) == 0)
+            return authenticated() ? auth_pages[i][1] : "/log.html";
     }
-    else if (*(p + 1) == '6')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return url;
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '7')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//请求带着有效的会话cookie，查一次会话表并刷新它的超时
+bool http_conn::authenticated()
+{
+    int len;
+    const char *sid = m_headers.cookie("sid", &len);
+    return sid && m_sessions.check(sid, len);
+}
 
-        free(m_url_real);
-    }
-    else
-    {
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    }
-****************************************************/
-
-    // if (*(p + 1) == 'i')
-    // {
-    //     char *m_url_real = (char *)malloc(sizeof(char) * 200);
-    //     strcpy(m_url_real, "/index.html");
-    //     strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-    //     free(m_url_real);
-    // }
-    // else
-    // {
-    //     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    // }
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    printf("m_real_file:%s\n", m_url);
+//把url对应的文件映射到内存
+http_conn::HTTP_CODE http_conn::map_file(const char *url)
+{
+    strcpy(m_real_file, doc_root);  //拼接文件的绝对地址
+    int len = strlen(doc_root);
+    strncpy(m_real_file + len, url, FILENAME_LEN - len - 1);
+    printf("m_real_file:%s\n", url);
     if (stat(m_real_file, &m_file_stat) < 0)    //资源是否存在
         return NO_RESOURCE;
     if (!(m_file_stat.st_mode & S_IROTH))   //判断文件权限是否可读
         return FORBIDDEN_REQUEST;
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
+    //大文件换到大文件lane，在那里用MAP_POPULATE把文件读进内存，reactor发送时不会因缺页卡在磁盘上
+    //登录注册的结果页面都很小，不会走到这里，所以重新执行do_request不会重复校验
+    if (m_file_stat.st_size > LARGE_FILE_SIZE && m_lane == LANE_STATIC)
+    {
+        m_lane = LANE_LARGE;
+        m_check_state = CHECK_STATE_DONE;
+        return REQUEUE_REQUEST;
+    }
+    int flags = MAP_PRIVATE;
+    if (m_lane == LANE_LARGE)
+        flags |= MAP_POPULATE;
     int fd = open(m_real_file, O_RDONLY);   //只读打开目标文件，返回fd
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, flags, fd, 0);
     close(fd);
     return FILE_REQUEST;
 }
+//POST到/2xxx是登录，/3xxx是注册，返回'2'或'3'，其他请求返回0
+char http_conn::cgi_flag()
+{
+    if (cgi != 1 || !m_url)
+        return 0;
+    const char *p = strrchr(m_url, '/');    //找到最后一次出现 / 的地址给p
+    if (p && (*(p + 1) == '2' || *(p + 1) == '3'))
+        return *(p + 1);
+    return 0;
+}
+
+//将用户名和密码提取出来
+//user=123&password=123
+bool http_conn::parse_form(char *name, char *password)
+{
+    int n = m_content_length;   //报文体不以\0结尾
+    if (!m_string || n < 5 || strncmp(m_string, "user=", 5) != 0)
+        return false;
+    int i;
+    for (i = 5; i < n && m_string[i] != '&' && i - 5 < FORM_FIELD_LEN - 1; ++i)
+        name[i - 5] = m_string[i];
+    name[i - 5] = '\0';
+    if (n - i < 10 || strncmp(m_string + i, "&password=", 10) != 0)
+        return false;
+
+    int j = 0;
+    for (i = i + 10; i < n && j < FORM_FIELD_LEN - 1; ++i, ++j)
+        password[j] = m_string[i];
+    password[j] = '\0';
+    return true;
+}
+
+//若浏览器端输入的用户名和密码在表中可以查找到，返回true
+bool http_conn::check_login(const char *name, const char *password)
+{
+    return users.check(name, password);
+}
+
+//同步注册，先检测是否有重名的，没有重名的，进行增加数据
+//用户名先进内存表，马上就能登录；写入交给后端(MySQL时由user_batcher合并写库)，持久化后才返回
+//写库失败再从内存表里删掉，等待期间不持有任何锁，注册之间不再互相串行
+static void wake_register(user_write *w)
+{
+    ((sem *)w->arg)->post();
+}
+
+bool http_conn::do_register(const char *name, const char *password)
+{
+    if (!reserve_user(name, password))
+        return false;
+    sem done;
+    user_write w;
+    w.name = name;
+    w.password = password;
+    w.done = wake_register;
+    w.arg = &done;
+    if (m_store->submit(&w))
+        done.wait();
+    if (w.status != user_write::OK)
+        release_user(name);
+    return w.status == user_write::OK;
+}
+
+//注册时先在内存表里占住用户名，数据库写失败再释放
+bool http_conn::reserve_user(const char *name, const char *password)
+{
+    return users.insert(name, password);
+}
+
+void http_conn::release_user(const char *name)
+{
+    users.erase(name);
+}
+
+//登录注册的校验，flag为'2'是登录，'3'是注册，返回结果页面的url
+//只有注册要写数据库，静态文件请求完全不碰连接池
+const char *http_conn::do_cgi(char flag)
+{
+    char name[FORM_FIELD_LEN], password[FORM_FIELD_LEN];
+    if (flag == '3')
+        return (parse_form(name, password) && do_register(name, password)) ? "/log.html" : "/registerError.html";
+    if (authenticated())
+        return "/welcome.html";     //已经登录过，不用再解析表单比对密码
+    if (!parse_form(name, password) || !check_login(name, password))
+        return "/logError.html";
+    //会话表满了就不发cookie，登录照样成功
+    if (!m_sessions.create(name, m_new_sid))
+        m_new_sid[0] = '\0';
+    return "/welcome.html";
+}
+
 void http_conn::unmap()
 {
     if (m_file_address)
@@ -571,80 +749,84 @@ void http_conn::unmap()
     }
 }
 
+//发送排队的响应，一次发完一整批；SSL_write不能聚集写，连续的短段先拷到一起再写，长段(文件)直接写
+//连接设置了SSL_MODE_ENABLE_PARTIAL_WRITE和ACCEPT_MOVING_WRITE_BUFFER，WANT_WRITE之后从同一位置重新拼出的内容相同，可以接着写
 bool http_conn::write()
 {
-    int temp = 0;
-
-    if (bytes_to_send == 0)
+    static thread_local char coalesce_buf[16384];   //一个TLS记录的最大长度
+    if (m_iv_count == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
+        //没有要发的，回去等请求；读缓冲区里有字节的话由reactor交给线程池
+        if (!pipelined())
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
         return true;
     }
-
-    while (1)
+    while (bytes_to_send > 0)
     {
-        // temp = writev(m_sockfd, m_iv, m_iv_count);  //write()将不连续的内存发出去要多次write,writev只需一次系统调用
-        // temp = 0;
-        // for (int i = 0; i < m_iv_count; i++)
-        // {
-        //     temp += SSL_write(fd2ssl[m_sockfd], m_iv[i].iov_base, m_iv[i].iov_len); 
-        // }
-        if (m_iv_count == 1)
+        const char *buf;
+        size_t len;
+        struct iovec *iv = &m_iv[m_iv_idx];
+        if (iv->iov_len >= SEND_COALESCE || m_iv_idx + 1 == m_iv_count)
         {
-            temp = SSL_write(fd2ssl[m_sockfd], m_iv[0].iov_base, m_iv[0].iov_len); 
+            buf = (const char *)iv->iov_base;
+            len = iv->iov_len;
         }
-        else if (m_iv_count == 2)
+        else
         {
-            char *pDes = new char[m_iv[0].iov_len + m_iv[1].iov_len];
-            memcpy(pDes, m_iv[0].iov_base, m_iv[0].iov_len);
-	        memcpy(pDes + m_iv[0].iov_len, m_iv[1].iov_base, m_iv[1].iov_len);
-            temp = SSL_write(fd2ssl[m_sockfd], pDes, m_iv[0].iov_len + m_iv[1].iov_len); 
-            delete pDes;
+            len = 0;
+            for (int k = m_iv_idx; k < m_iv_count && len < sizeof(coalesce_buf); ++k)
+            {
+                size_t n = m_iv[k].iov_len < sizeof(coalesce_buf) - len ? m_iv[k].iov_len : sizeof(coalesce_buf) - len;
+                memcpy(coalesce_buf + len, m_iv[k].iov_base, n);
+                len += n;
+            }
+            buf = coalesce_buf;
         }
+        if (len > INT_MAX)
+            len = INT_MAX;
 
-        if (temp < 0)
+        ERR_clear_error();
+        int temp = SSL_write(m_ssl, buf, len);
+        if (temp <= 0)
         {
-            if (errno == EAGAIN)
+            int err = SSL_get_error(m_ssl, temp);
+            if (err == SSL_ERROR_WANT_WRITE || errno == EAGAIN)
             {
                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
             printf("写失败");
-            unmap();
+            clear_responses();
             return false;
         }
 
-        bytes_have_send += temp;
+        //按写出去的字节数推进到对应的段
         bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
+        size_t sent = temp;
+        while (sent > 0)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
-
-        if (bytes_to_send <= 0)
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
+            struct iovec *cur = &m_iv[m_iv_idx];
+            size_t n = sent < cur->iov_len ? sent : cur->iov_len;
+            cur->iov_base = (char *)cur->iov_base + n;
+            cur->iov_len -= n;
+            sent -= n;
+            if (cur->iov_len == 0)
+                ++m_iv_idx;
         }
     }
+
+    //整批发完，下一个请求的解析状态在响应排队时已经准备好了
+    bool keep_alive = m_keep_alive;
+    clear_responses();
+    if (!keep_alive)
+        return false;
+    //TLS里可能还缓着对端一起发来的请求，epoll看不到，先读进来
+    if (SSL_pending(m_ssl) > 0 && m_read_idx < READ_BUFFER_SIZE)
+        read_once();
+    if (pipelined())
+        return true;    //读缓冲区里已经有下一个请求，reactor直接交给线程池
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+    return true;
 }
 
 bool http_conn::add_response(const char *format, ...)
@@ -671,9 +853,7 @@ bool http_conn::add_status_line(int status, const char *title)
 }
 bool http_conn::add_headers(int content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && (!m_new_sid[0] || add_set_cookie()) && add_blank_line();
 }
 bool http_conn::add_content_length(int content_len)
 {
@@ -691,12 +871,23 @@ bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
 }
+bool http_conn::add_retry_after()
+{
+    return add_response("Retry-After:%d\r\n", RETRY_AFTER);
+}
+//不带Max-Age，浏览器关掉就丢，服务器端按空闲时间过期
+bool http_conn::add_set_cookie()
+{
+    return add_response("Set-Cookie:sid=%s; Path=/; Secure; HttpOnly; SameSite=Lax\r\n", m_new_sid);
+}
 bool http_conn::add_content(const char *content)
 {
     return add_response("%s", content);
 }
+//生成响应，排到发送队列的末尾，流水线上的几个请求的响应一起发
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    int start = m_write_idx;    //这个响应的响应头在写缓冲区里的起点
     switch (ret)
     {
     case INTERNAL_ERROR:
@@ -715,6 +906,15 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case SERVICE_UNAVAILABLE:
+    {
+        add_status_line(503, error_503_title);
+        add_retry_after();
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    }
     case FORBIDDEN_REQUEST:
     {
         add_status_line(403, error_403_title);
@@ -728,46 +928,239 @@ bool http_conn::process_write(HTTP_CODE ret)
         add_status_line(200, ok_200_title);
         if (m_file_stat.st_size != 0)
         {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf; //响应报文缓冲区
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;  //响应文件
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            if (!add_headers(m_file_stat.st_size))
+                return false;
+            queue_response(m_write_buf + start, m_write_idx - start);   //响应头
+            queue_response(m_file_address, m_file_stat.st_size);       //响应文件
+            //映射交给发送队列，整批发完再解除
+            m_mapped[m_mapped_count].iov_base = m_file_address;
+            m_mapped[m_mapped_count].iov_len = m_file_stat.st_size;
+            ++m_mapped_count;
+            m_file_address = 0;
+            ++m_responses;
+            m_keep_alive = m_linger;
             return true;
         }
         else
         {
             //请求资源大小为0，返回空白html
+            unmap();
             const char *ok_string = "<html><body></body></html>";
             add_headers(strlen(ok_string));
             if (!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
     // 不是FILE_REQUEST的话只需要指向响应报文缓冲区
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    queue_response(m_write_buf + start, m_write_idx - start);
+    ++m_responses;
+    m_keep_alive = m_linger;
     return true;
 }
-void http_conn::process()
+
+//在发送队列末尾加一段，和前一段在内存里相连(写缓冲区里相邻的响应头)就合成一段
+void http_conn::queue_response(char *base, size_t len)
 {
-    HTTP_CODE read_ret = process_read();    // 完成报文读取
-    if (read_ret == NO_REQUEST) //请求不完整，需要继续接收请求数据
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);    //在这个socketfd上注册并监听读事件
+    if (len == 0)
         return;
+    bytes_to_send += len;
+    if (m_iv_count > 0)
+    {
+        struct iovec *last = &m_iv[m_iv_count - 1];
+        if ((char *)last->iov_base + last->iov_len == base)
+        {
+            last->iov_len += len;
+            return;
+        }
     }
-    bool write_ret = process_write(read_ret);   // 完成报文响应
-    if (!write_ret)
+    m_iv[m_iv_count].iov_base = base;
+    m_iv[m_iv_count].iov_len = len;
+    ++m_iv_count;
+}
+//返回false表示请求换了lane，连接仍归调用方所有，由线程池重新入队；返回true表示已交回reactor或协程
+//流水线：读缓冲区里已经收全的请求一个接一个处理，响应排在一起，攒满一批或者没有完整的请求了再交给reactor一次发出
+//换lane和交给协程的请求排在已经排好的响应后面，它的响应生成之后整批一起发
+bool http_conn::process()
+{
+    //换过lane的请求报文已经解析完，直接从do_request继续
+    HTTP_CODE read_ret = (m_check_state == CHECK_STATE_DONE) ? do_request() : process_read();    // 完成报文读取
+    while (true)
     {
-        close_conn();
+        if (read_ret == REQUEUE_REQUEST)
+            return false;
+        if (read_ret == COROUTINE_REQUEST)
+        {
+            //剩下的工作交给协程，在连接所属的reactor线程里开始
+            m_lane = LANE_DB;   //结果页面在协程里直接映射，不再换lane
+            m_cancelled = false;
+            m_co = true;
+            co_cgi().start(m_sched);
+            return true;
+        }
+        if (read_ret == NO_REQUEST) //请求不完整，需要继续接收请求数据
+        {
+            //剩下的字节可能已经在TLS的缓冲里，epoll不会再报可读，连接在本线程手里，直接读
+            if (SSL_pending(m_ssl) > 0 && m_read_idx < READ_BUFFER_SIZE && read_once())
+            {
+                read_ret = process_read();
+                continue;
+            }
+            //前面的请求的响应先发出去，发完reactor看到读缓冲区里还有字节会再交回来
+            modfd(m_epollfd, m_sockfd, m_iv_count ? EPOLLOUT : EPOLLIN);
+            return true;
+        }
+        if (read_ret == SERVICE_UNAVAILABLE)
+            m_linger = false;   //请求体没有读，发完503就关闭
+        //要关闭连接、这批满了或者读缓冲区里没有下一个请求了，就交给reactor发送
+        if (!enqueue(read_ret) || !m_keep_alive || m_responses >= PIPELINE_MAX ||
+            WRITE_BUFFER_SIZE - m_write_idx < WRITE_RESERVE || m_read_idx == 0)
+            break;
+        read_ret = process_read();
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT);   //在这个socketfd上注册并监听写事件
+    return true;
+}
+
+//生成响应排进发送队列，连接保持的话解析状态转到流水线上的下一个请求，返回false表示出错
+bool http_conn::enqueue(HTTP_CODE ret)
+{
+    if (!process_write(ret))
+    {
+        //不在工作线程里直接关闭：定时器挂在所属reactor的时间轮上，只能由那个线程摘除
+        //关掉socket的读写两端，reactor随后收到EPOLLHUP，走统一的关闭流程
+        shutdown(m_sockfd, SHUT_RDWR);
+        return false;
+    }
+    if (m_linger)
+        next_request();
+    return true;
+}
+
+//生成响应报文，交给reactor发送
+void http_conn::respond(HTTP_CODE read_ret)
+{
+    enqueue(read_ret);
+    modfd(m_epollfd, m_sockfd, EPOLLOUT);   //在这个socketfd上注册并监听写事件
+}
+
+//请求队列满了，reactor不再排队，直接在本线程回一个503然后关闭连接
+//连接这时不在任何工作线程手里，可以直接写；返回false表示已经写完或出错，调用方关闭连接
+//写不完时write()会注册EPOLLOUT，剩下的由reactor在可写时继续发
+bool http_conn::reject()
+{
+    m_linger = false;
+    if (!process_write(SERVICE_UNAVAILABLE))
+        return false;
+    return write();
+}
+
+//请求在队列里等得太久，由工作线程回503而不去处理，响应由reactor发出，发完关闭连接
+void http_conn::shed()
+{
+    m_linger = false;
+    if (!process_write(SERVICE_UNAVAILABLE))
+        shutdown(m_sockfd, SHUT_RDWR);
+    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
+
+//登录注册的协程版本，整个协程都在连接所属的reactor线程里运行：
+//报文没收全时co_await socket可读；校验、注册和打开结果页面可能阻塞，交给阻塞线程池，
+//挂起期间reactor线程去处理别的连接，少量线程就能同时挂着大量慢请求
+co_task http_conn::co_cgi()
+{
+    //1. 接着解析请求头和报文体，不完整就等socket可读
+    HTTP_CODE ret;
+    while ((ret = process_read()) == NO_REQUEST)
+    {
+        uint32_t revents = co_await m_sched->wait_fd(m_sockfd, EPOLLIN);
+        if (m_cancelled || (revents & (EPOLLHUP | EPOLLERR)) || !read_once())
+        {
+            co_abort();
+            co_return;
+        }
+    }
+
+    if (ret == GET_REQUEST)
+    {
+        //2. 登录校验或注册，注册要写数据库
+        char flag = cgi_flag();
+        const char *page = NULL;
+        bool ok;
+        if (flag == '3')
+        {
+            //注册不占任何线程：用户名进内存表后交给后端写入，协程挂起到持久化为止
+            char name[FORM_FIELD_LEN], password[FORM_FIELD_LEN];
+            page = "/registerError.html";
+            ok = true;
+            if (parse_form(name, password) && reserve_user(name, password))
+            {
+                int status = co_await co_register_user(m_store, m_sched, name, password);
+                if (status == user_write::OK)
+                    page = "/log.html";
+                else
+                {
+                    release_user(name);
+                    ok = status != user_write::BUSY;    //后端忙回503
+                }
+            }
+        }
+        else if (authenticated())
+        {
+            page = "/welcome.html";     //已登录，查一次会话表就够，不用交给阻塞线程池
+            ok = true;
+        }
+        else
+            ok = co_await co_offload(m_offload, m_sched, [this, flag, &page] { page = do_cgi(flag); });
+        if (!ok)
+            ret = SERVICE_UNAVAILABLE;
+        //3. 打开结果页面，读文件也可能阻塞
+        else if (!co_await co_offload(m_offload, m_sched, [this, page, &ret] { ret = map_file(page); }))
+            ret = SERVICE_UNAVAILABLE;
+    }
+    if (m_cancelled)
+    {
+        unmap();
+        co_abort();
+        co_return;
+    }
+
+    //4. 回到reactor线程，生成响应交给reactor发送
+    if (ret == SERVICE_UNAVAILABLE)
+        m_linger = false;
+    m_co = false;
+    respond(ret);
+}
+
+//协程处理不下去了，关掉socket，reactor随后收到EPOLLHUP走统一的关闭流程
+void http_conn::co_abort()
+{
+    m_co = false;
+    shutdown(m_sockfd, SHUT_RDWR);
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+}
+
+//定时器到期时调用，连接在协程手里就不能直接关闭，返回true表示交给协程收尾
+//协程在等socket就让它马上带着错误恢复，在阻塞线程池里就等它回来后看到m_cancelled再退出；
+//协程已经交给reactor但还没开始等socket时，调度器记下这次取消，协程第一次等socket就会失败退出
+bool http_conn::co_cancel()
+{
+    if (!m_co)
+        return false;
+    m_cancelled = true;
+    m_sched->cancel_fd(m_sockfd);
+    return true;
+}
+
+//定时器到期时连接在工作线程手里，不能在reactor线程里释放它正在用的SSL对象，返回true表示交给工作线程收尾
+//只关掉socket，工作线程的读写随之出错，它重置EPOLLONESHOT后reactor收到EPOLLHUP，再走统一的关闭流程
+bool http_conn::pool_cancel()
+{
+    if (!m_in_pool)
+        return false;
+    shutdown(m_sockfd, SHUT_RDWR);
+    return true;
 }
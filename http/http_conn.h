@@ -23,9 +23,16 @@
 #include "../CGImysql/sql_connection_pool.h"
 
 #pragma once
-#include <unordered_map>
+#include <atomic>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include "../coroutine/co_task.h"
+#include "../coroutine/co_offload.h"
+#include "../coroutine/co_user.h"
+#include "session_store.h"
+#include "http_header.h"
+
+#define CO_HANDLER  //登录注册用协程处理，注释掉则在数据库lane上同步处理
 
 
 class http_conn
@@ -34,6 +41,12 @@ public:
     static const int FILENAME_LEN = 200;
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 4096;
+    static const int PIPELINE_MAX = 8;      //一批最多排这么多个响应，流水线上后面的请求等这批发完再解析
+    static const int WRITE_RESERVE = 1024;  //写缓冲区剩下不到这么多就不再往这批里加响应
+    static const int SEND_COALESCE = 4096;  //比它短的几段拼成一次SSL_write，少出几个TLS记录
+    static const int RETRY_AFTER = 1;   //过载时503响应里建议客户端重试的秒数
+    static const int LARGE_FILE_SIZE = 1024 * 1024; //超过它的文件在大文件lane上映射
+    static const int FORM_FIELD_LEN = 100;  //登录注册表单里用户名和密码的最大长度
     enum METHOD
     {
         GET = 0,
@@ -50,7 +63,8 @@ public:
     {
         CHECK_STATE_REQUESTLINE = 0,
         CHECK_STATE_HEADER,
-        CHECK_STATE_CONTENT
+        CHECK_STATE_CONTENT,
+        CHECK_STATE_DONE    //报文已解析完，换lane后从do_request继续
     };
     enum HTTP_CODE
     {
@@ -61,7 +75,10 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        SERVICE_UNAVAILABLE,
+        REQUEUE_REQUEST,    //请求换了lane，交回线程池重新入队
+        COROUTINE_REQUEST   //剩下的工作交给协程
     };
     enum LINE_STATUS
     {
@@ -69,33 +86,93 @@ public:
         LINE_BAD,
         LINE_OPEN
     };
+    //线程池按lane分别排队，lane 0以外的lane有并发上限
+    enum LANE
+    {
+        LANE_STATIC = 0,    //静态文件，处理很快
+        LANE_DB,            //登录注册，要访问数据库
+        LANE_LARGE          //大文件，映射时要从磁盘读
+    };
+    enum HANDSHAKE_STATUS
+    {
+        HANDSHAKE_OK = 0,
+        HANDSHAKE_AGAIN,
+        HANDSHAKE_ERROR
+    };
 
 public:
-    http_conn() {}
+    http_conn() : m_worker(-1), m_lane(LANE_STATIC), m_sched(NULL), m_co(false), m_cancelled(false), m_in_pool(false), m_sockfd(-1), m_ssl(NULL), m_handshaking(false), m_file_address(NULL), m_iv_count(0), m_mapped_count(0) {}
     ~http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr);
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, SSL *ssl, co_scheduler *sched);
     void close_conn(bool real_close = true);
-    void process();
+    bool process();
     bool read_once();
     bool write();
+    //一批响应发完了，读缓冲区里已经有下一个请求的字节，reactor要直接交给线程池，没有注册EPOLLIN
+    bool pipelined() const
+    {
+        return bytes_to_send == 0 && m_read_idx > 0;
+    }
+    HANDSHAKE_STATUS do_handshake();
+    bool reject();
+    void shed();
+    bool co_cancel();
+    bool pool_cancel();
+    //reactor把连接放进线程池后置位，收到这个fd的下一个事件时清掉：EPOLLONESHOT下工作线程重置事件之前不会有事件
+    void set_in_pool(bool in_pool)
+    {
+        m_in_pool = in_pool;
+    }
+    bool co_owned()
+    {
+        return m_co;
+    }
+    bool is_handshaking()
+    {
+        return m_handshaking;
+    }
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    void initmysql_result(connection_pool *connPool);
+    //当前请求的请求头，没有返回NULL，值不一定以\0结尾
+    const char *get_header(HEADER_ID id, int *len) const
+    {
+        return m_headers.get(id, len);
+    }
+    static bool load_users();
+    static void save_users();
 
 private:
     void init();
+    void next_request();
+    void clear_responses();
+    void queue_response(char *base, size_t len);
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
-    HTTP_CODE parse_request_line(char *text);
-    HTTP_CODE parse_headers(char *text);
+    HTTP_CODE parse_request_line(char *text, int len);
+    HTTP_CODE parse_headers(char *text, int len);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
+    HTTP_CODE map_file(const char *url);
+    void respond(HTTP_CODE ret);
+    bool enqueue(HTTP_CODE ret);
+    co_task co_cgi();
+    void co_abort();
+    const char *do_cgi(char flag);
+    bool parse_form(char *name, char *password);
+    bool check_login(const char *name, const char *password);
+    bool authenticated();
+    const char *auth_page(const char *url);
+    bool do_register(const char *name, const char *password);
+    bool reserve_user(const char *name, const char *password);
+    void release_user(const char *name);
+    char cgi_flag();
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
+    int find_delim(int from, int to, char a, char b);
     void unmap();
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
@@ -105,19 +182,37 @@ private:
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_retry_after();
+    bool add_set_cookie();
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count;   //所有reactor共享，需要原子操作
+    static user_store *m_store;             //用户数据的后端，启动时选择
+    static co_executor *m_offload;          //协程里阻塞的工作交给这个线程池
+    static uint64_t m_user_cursor;          //已经读进内存表的最大用户id，只被后台的warm_up线程访问
+    static std::atomic<bool> m_db_ready;    //连接池和用户表在后台准备好之前，登录注册回503
+    static session_store m_sessions;        //登录会话，由reactor 0的时间轮每秒推进过期
     MYSQL *mysql;
+    int m_worker;   //最近处理这个连接的工作线程，线程池按它把请求派回同一个线程
+    int m_lane;     //当前请求所属的lane，解析请求行后确定，请求处理完回到LANE_STATIC
+    long long m_queued_at;  //进入请求队列的时间(微秒)，线程池用来统计排队时间
 
 private:
+    int m_epollfd;  //连接所属reactor的epoll，工作线程用它重置EPOLLONESHOT
+    co_scheduler *m_sched;      //连接所属reactor的协程调度器
+    std::atomic<bool> m_co;     //连接是否在协程手里
+    std::atomic<bool> m_cancelled;  //协程挂起期间连接超时了，工作线程交出连接前清零，之后reactor线程置位、协程读
+    bool m_in_pool;             //连接在工作线程手里，只在reactor线程读写
     int m_sockfd;
+    SSL *m_ssl;         //本连接的TLS会话，读写时直接使用，不再查表
+    bool m_handshaking; //TLS握手是否还在进行
     sockaddr_in m_address;
     char m_read_buf[READ_BUFFER_SIZE];
     int m_read_idx;
     int m_checked_idx;  // 状态机读到buffer的位置
     int m_start_line;
+    uint64_t m_delims[READ_BUFFER_SIZE / 64];   //读缓冲区里分隔符的位图，见http_scan.h
+    int m_indexed_idx;  //位图覆盖到的位置，之后的字节还没建索引
     char m_write_buf[WRITE_BUFFER_SIZE];
     int m_write_idx;
     CHECK_STATE m_check_state;
@@ -125,17 +220,23 @@ private:
     char m_real_file[FILENAME_LEN];
     char *m_url;
     char *m_version;
-    char *m_host;
     int m_content_length;
     bool m_linger;
     char *m_file_address;
     struct stat m_file_stat;
-    struct iovec m_iv[2];
+    struct iovec m_iv[2 * PIPELINE_MAX];    //排队待发的响应，每个是响应头和可能有的文件两段，相连的响应头合成一段
     int m_iv_count;
+    int m_iv_idx;           //正在发的那一段
+    struct iovec m_mapped[PIPELINE_MAX];    //排队的响应映射的文件，整批发完再解除映射
+    int m_mapped_count;
+    int m_responses;        //这批排了几个响应
+    bool m_keep_alive;      //这批发完后连接是否保持，由最后一个响应决定
+    int m_request_end;      //当前请求在读缓冲区里结束的位置，后面是流水线上的下一个请求
     int cgi;        //是否启用的POST
     char *m_string; //存储请求头数据
+    header_table m_headers;             //请求头，只记在m_read_buf里的位置
+    char m_new_sid[SESSION_ID_LEN + 1]; //这次登录新发的会话id，响应里用Set-Cookie发给浏览器
     int bytes_to_send;
-    int bytes_have_send;
 };
 
 #endif
@@ -0,0 +1,234 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+// 认识的请求头，名字到编号用编译期算出来的完美hash查：
+// 名字按小写做带种子的FNV-1a，取高HEADER_HASH_BITS位做槽号，编译时从一个种子开始往上试，直到这些名字互不冲突
+// 查找时算一次hash、取一个槽、比一次名字，不管认识多少个头部都是这样
+enum HEADER_ID
+{
+    HDR_UNKNOWN = -1,
+    HDR_HOST = 0,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_COOKIE,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_REFERER,
+    HDR_USER_AGENT,
+    HDR_UPGRADE,
+    HDR_COUNT
+};
+
+//下标是HEADER_ID，必须是小写
+inline constexpr const char *header_names[HDR_COUNT] = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "cookie",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "if-none-match",
+    "if-modified-since",
+    "range",
+    "if-range",
+    "referer",
+    "user-agent",
+    "upgrade"};
+
+#define HEADER_HASH_BITS 6
+#define HEADER_HASH_SIZE (1 << HEADER_HASH_BITS)
+
+constexpr size_t header_name_len(const char *s)
+{
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+//|0x20把大写字母变成小写，请求头名字里的数字和'-'本来就有这一位，不受影响
+constexpr uint32_t header_hash(const char *s, size_t n, uint32_t seed)
+{
+    uint32_t h = seed;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ (uint8_t)(s[i] | 0x20)) * 16777619u;
+    return (h ^ (uint32_t)n) >> (32 - HEADER_HASH_BITS);
+}
+
+constexpr uint32_t header_find_seed()
+{
+    for (uint32_t seed = 2166136261u;; ++seed)
+    {
+        bool used[HEADER_HASH_SIZE] = {};
+        bool ok = true;
+        for (int i = 0; i < HDR_COUNT && ok; ++i)
+        {
+            uint32_t slot = header_hash(header_names[i], header_name_len(header_names[i]), seed);
+            ok = !used[slot];
+            used[slot] = true;
+        }
+        if (ok)
+            return seed;
+    }
+}
+
+inline constexpr uint32_t HEADER_HASH_SEED = header_find_seed();
+
+struct header_slots
+{
+    int8_t id[HEADER_HASH_SIZE];
+    uint8_t len[HDR_COUNT];
+};
+
+constexpr header_slots header_build_slots()
+{
+    header_slots t = {};
+    for (int i = 0; i < HEADER_HASH_SIZE; ++i)
+        t.id[i] = HDR_UNKNOWN;
+    for (int i = 0; i < HDR_COUNT; ++i)
+    {
+        t.len[i] = header_name_len(header_names[i]);
+        t.id[header_hash(header_names[i], t.len[i], HEADER_HASH_SEED)] = i;
+    }
+    return t;
+}
+
+inline constexpr header_slots HEADER_SLOTS = header_build_slots();
+
+static_assert(HEADER_SLOTS.id[header_hash("Content-Length", 14, HEADER_HASH_SEED)] == HDR_CONTENT_LENGTH, "header hash must ignore case");
+
+//名字不认识返回HDR_UNKNOWN
+inline HEADER_ID header_lookup(const char *name, size_t len)
+{
+    int id = HEADER_SLOTS.id[header_hash(name, len, HEADER_HASH_SEED)];
+    if (id < 0 || HEADER_SLOTS.len[id] != len || strncasecmp(name, header_names[id], len) != 0)
+        return HDR_UNKNOWN;
+    return (HEADER_ID)id;
+}
+
+// 一个请求的所有请求头，只记在读缓冲区里的偏移和长度，不拷贝：
+// 认识的头部按编号直接放，同名的后一个覆盖前一个；不认识的按顺序放，最多HEADER_MAX_OTHER个，再多的丢掉
+// 值已经去掉了两边的空白，按长度访问，不一定以\0结尾
+class header_table
+{
+public:
+    static const int HEADER_MAX_OTHER = 24;
+
+    //新请求开始时调用，base是读缓冲区
+    void reset(const char *base)
+    {
+        m_base = base;
+        m_other_count = 0;
+        for (int i = 0; i < HDR_COUNT; ++i)
+            m_known[i].off = 0;
+    }
+
+    //name和value都在读缓冲区里，返回头部的编号
+    HEADER_ID add(const char *name, int name_len, const char *value, int value_len)
+    {
+        HEADER_ID id = header_lookup(name, name_len);
+        if (id != HDR_UNKNOWN)
+            m_known[id] = make_view(value, value_len);
+        else if (m_other_count < HEADER_MAX_OTHER)
+        {
+            m_other[m_other_count].name = make_view(name, name_len);
+            m_other[m_other_count].value = make_view(value, value_len);
+            ++m_other_count;
+        }
+        return id;
+    }
+
+    //没有这个头部返回NULL
+    const char *get(HEADER_ID id, int *len) const
+    {
+        if (!m_known[id].off)
+            return NULL;
+        *len = m_known[id].len;
+        return m_base + m_known[id].off;
+    }
+    //任意名字，认识的名字按编号查，其他的在不认识的头部里逐个比
+    const char *get(const char *name, int *len) const
+    {
+        size_t name_len = header_name_len(name);
+        HEADER_ID id = header_lookup(name, name_len);
+        if (id != HDR_UNKNOWN)
+            return get(id, len);
+        for (int i = 0; i < m_other_count; ++i)
+        {
+            if (m_other[i].name.len == name_len && strncasecmp(m_base + m_other[i].name.off, name, name_len) == 0)
+            {
+                *len = m_other[i].value.len;
+                return m_base + m_other[i].value.off;
+            }
+        }
+        return NULL;
+    }
+    //Cookie头部里名为name的cookie的值，没有返回NULL
+    const char *cookie(const char *name, int *len) const
+    {
+        int n;
+        const char *p = get(HDR_COOKIE, &n);
+        if (!p)
+            return NULL;
+        const char *end = p + n;
+        size_t name_len = header_name_len(name);
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+                ++p;
+            const char *q = p;
+            while (q < end && *q != ';')
+                ++q;
+            if ((size_t)(q - p) > name_len && p[name_len] == '=' && strncmp(p, name, name_len) == 0)
+            {
+                *len = q - p - name_len - 1;
+                return p + name_len + 1;
+            }
+            p = q;
+        }
+        return NULL;
+    }
+
+private:
+    //偏移为0的是请求行，不会是头部，用它表示没有
+    struct view
+    {
+        uint16_t off;
+        uint16_t len;
+    };
+    struct field
+    {
+        view name;
+        view value;
+    };
+
+    view make_view(const char *p, int n) const
+    {
+        view v;
+        v.off = p - m_base;
+        v.len = n;
+        return v;
+    }
+
+    const char *m_base;
+    view m_known[HDR_COUNT];
+    field m_other[HEADER_MAX_OTHER];
+    int m_other_count;
+};
+
+#endif
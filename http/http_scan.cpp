@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "http_scan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+typedef void (*index_fn)(const char *buf, size_t from, size_t to, uint64_t *bits);
+
+static void index_scalar(const char *buf, size_t from, size_t to, uint64_t *bits)
+{
+    for (size_t i = from; i < to; ++i)
+    {
+        if (http_is_delim(buf[i]))
+            bits[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+#ifdef HTTP_SCAN_X86
+//从位置i开始的width个字节的命中掩码并进位图，跨64位边界时拆到下一个字
+static inline void put_mask(uint64_t *bits, size_t i, uint64_t mask, unsigned width)
+{
+    size_t shift = i & 63;
+    bits[i >> 6] |= mask << shift;
+    if (shift > 64 - width)
+        bits[(i >> 6) + 1] |= mask >> (64 - shift);
+}
+
+//整个函数按SSE4.2编译，不影响其余代码的编译选项；不足16字节的尾巴逐字节查
+__attribute__((target("sse4.2"))) static void index_sse42(const char *buf, size_t from, size_t to, uint64_t *bits)
+{
+    const __m128i set = _mm_setr_epi8('\r', '\n', ':', ' ', '\t', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = from;
+    for (; i + 16 <= to; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i m = _mm_cmpestrm(set, 5, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        uint64_t mask = (uint32_t)_mm_cvtsi128_si32(m) & 0xffff;
+        if (mask)
+            put_mask(bits, i, mask, 16);
+    }
+    index_scalar(buf, i, to, bits);
+}
+
+//一次比较32字节，五个字符各比一次合成掩码
+__attribute__((target("avx2"))) static void index_avx2(const char *buf, size_t from, size_t to, uint64_t *bits)
+{
+    const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n'), colon = _mm256_set1_epi8(':'),
+                  sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    size_t i = from;
+    for (; i + 32 <= to; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)),
+                                      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, sp)), _mm256_cmpeq_epi8(v, tab)));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask)
+            put_mask(bits, i, mask, 32);
+    }
+    //一次read往往只多出几十个字节，剩下的先按16字节比一次
+    if (i + 16 <= to)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(cr)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(lf))),
+                                   _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(colon)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(sp))), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(tab))));
+        uint64_t mask = (uint32_t)_mm_movemask_epi8(hit);
+        if (mask)
+            put_mask(bits, i, mask, 16);
+        i += 16;
+    }
+    index_scalar(buf, i, to, bits);
+}
+#endif
+
+static const char *s_impl = "scalar";
+
+//在静态初始化时调用，早于main，所以先__builtin_cpu_init
+static index_fn pick()
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    const char *want = getenv("HTTP_SCAN");
+    if (want && strcmp(want, "scalar") == 0)
+        return index_scalar;
+    if ((!want || strcmp(want, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+    {
+        s_impl = "avx2";
+        return index_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        s_impl = "sse4.2";
+        return index_sse42;
+    }
+#endif
+    return index_scalar;
+}
+
+static const index_fn s_index = pick();
+
+void http_index(const char *buf, size_t from, size_t to, uint64_t *bits)
+{
+    s_index(buf, from, to, bits);
+}
+
+const char *http_scan_impl()
+{
+    return s_impl;
+}
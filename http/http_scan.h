@@ -0,0 +1,47 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 请求报文的分隔符索引，解析请求行和请求头只过一遍字节：
+// 读进来的字节由http_index一次比较16或32个，把\r \n : 空格 \t的位置在位图里置位，
+// 之后切行、找请求行里的空白、找请求头的冒号都只查位图(http_find)，不再逐字节重新扫描
+// 启动时按CPU选AVX2、SSE4.2或者逐字节的实现，环境变量HTTP_SCAN=avx2/sse4.2/scalar可以强制指定(CPU不支持的不选)
+// 不把\0当结束，范围由调用方给出，报文里夹着的\0不会截断查找
+
+//位图里置位的字节
+inline bool http_is_delim(char c)
+{
+    return c == '\r' || c == '\n' || c == ':' || c == ' ' || c == '\t';
+}
+
+//把buf的[from, to)里分隔符的位置在bits里置位，位i对应buf[i]；这一段的位原来要是0
+void http_index(const char *buf, size_t from, size_t to, uint64_t *bits);
+//选中的实现，启动时写日志用
+const char *http_scan_impl();
+
+//[from, to)里第一个等于a或b的字节的位置，没有返回to；a、b必须是分隔符，这一段要已经建过索引
+//字节建索引之后被改掉(比如\r\n换成了\0)的位置不会命中
+inline size_t http_find(const char *buf, const uint64_t *bits, size_t from, size_t to, char a, char b)
+{
+    while (from < to)
+    {
+        size_t w = from >> 6;
+        uint64_t m = bits[w] & (~0ULL << (from & 63));
+        if (!m)
+        {
+            from = (w + 1) << 6;
+            continue;
+        }
+        size_t i = (w << 6) + __builtin_ctzll(m);
+        if (i >= to)
+            break;
+        if (buf[i] == a || buf[i] == b)
+            return i;
+        from = i + 1;
+    }
+    return to;
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include <string.h>
+#include <openssl/rand.h>
+#include "session_store.h"
+#include "../log/log.h"
+
+#define SESSION_SHARD_MAX (SESSION_MAX / SESSION_SHARDS)
+
+session_store::session_store()
+{
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+        m_shards[i].map.reserve(SESSION_SHARD_MAX);
+}
+
+session_store::~session_store()
+{
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        shard &sh = m_shards[i];
+        for (auto &it : sh.map)
+        {
+            sh.wheel.del_timer(&it.second->timer);
+            delete it.second;
+        }
+        while (sh.free_list)
+        {
+            session *s = sh.free_list;
+            sh.free_list = s->next_free;
+            delete s;
+        }
+    }
+}
+
+//正好32个十六进制字符，大小写都认，长度不对或者有别的字符返回false
+bool session_store::parse_id(const char *sid, size_t len, session_id *id)
+{
+    if (len != SESSION_ID_LEN)
+        return false;
+    uint64_t v[2] = {0, 0};
+    for (int i = 0; i < SESSION_ID_LEN; ++i)
+    {
+        char c = sid[i];
+        int d;
+        if (c >= '0' && c <= '9')
+            d = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            d = c - 'A' + 10;
+        else
+            return false;
+        v[i / 16] = (v[i / 16] << 4) | d;
+    }
+    id->lo = v[0];
+    id->hi = v[1];
+    return true;
+}
+
+void session_store::format_id(const session_id &id, char *sid)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint64_t v[2] = {id.lo, id.hi};
+    for (int i = 0; i < SESSION_ID_LEN; ++i)
+        sid[i] = hex[(v[i / 16] >> (60 - 4 * (i % 16))) & 0xf];
+    sid[SESSION_ID_LEN] = '\0';
+}
+
+bool session_store::create(const char *user, char *sid)
+{
+    session_id id;
+    if (RAND_bytes((unsigned char *)&id, sizeof(id)) != 1)
+    {
+        LOG_ERROR("%s", "session id: RAND_bytes failure");
+        return false;
+    }
+    shard &sh = m_shards[id.lo & (SESSION_SHARDS - 1)];
+    sh.lock.lock();
+    session *s = sh.free_list;
+    if (s)
+        sh.free_list = s->next_free;
+    else if (sh.allocated < SESSION_SHARD_MAX)
+    {
+        s = new session;
+        s->owner = &sh;
+        s->timer.cb_func = expire;
+        s->timer.user_data = s;
+        ++sh.allocated;
+    }
+    //128位随机数撞上已有的会话几乎不可能，撞上了也不发，不能让两个人共用一个会话
+    if (!s || sh.map.count(id))
+    {
+        if (s)
+        {
+            s->next_free = sh.free_list;
+            sh.free_list = s;
+        }
+        ++sh.rejected;
+        sh.lock.unlock();
+        return false;
+    }
+    s->id = id;
+    strncpy(s->user, user, SESSION_USER_LEN - 1);
+    s->user[SESSION_USER_LEN - 1] = '\0';
+    sh.map.emplace(id, s);
+    sh.wheel.add_timer(&s->timer, SESSION_TIMEOUT);
+    ++sh.created;
+    sh.lock.unlock();
+    format_id(id, sid);
+    return true;
+}
+
+bool session_store::check(const char *sid, size_t len, char *user)
+{
+    session_id id;
+    if (!sid || !parse_id(sid, len, &id))
+        return false;
+    shard &sh = m_shards[id.lo & (SESSION_SHARDS - 1)];
+    sh.lock.lock();
+    auto it = sh.map.find(id);
+    bool ok = it != sh.map.end();
+    if (ok)
+    {
+        sh.wheel.adjust_timer(&it->second->timer, SESSION_TIMEOUT);
+        if (user)
+            strcpy(user, it->second->user);
+    }
+    sh.lock.unlock();
+    return ok;
+}
+
+void session_store::remove(const char *sid, size_t len)
+{
+    session_id id;
+    if (!sid || !parse_id(sid, len, &id))
+        return;
+    shard &sh = m_shards[id.lo & (SESSION_SHARDS - 1)];
+    sh.lock.lock();
+    auto it = sh.map.find(id);
+    if (it != sh.map.end())
+    {
+        sh.wheel.del_timer(&it->second->timer);
+        release(it->second);
+    }
+    sh.lock.unlock();
+}
+
+//从表里删掉，节点放回空闲链表，持有分片的锁时调用
+void session_store::release(session *s)
+{
+    shard *sh = s->owner;
+    sh->map.erase(s->id);
+    s->next_free = sh->free_list;
+    sh->free_list = s;
+}
+
+//时间轮到期的回调，在tick里持有分片的锁时调用
+void session_store::expire(session *s)
+{
+    ++s->owner->expired;
+    release(s);
+}
+
+void session_store::tick(unsigned long seconds)
+{
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        shard &sh = m_shards[i];
+        sh.lock.lock();
+        for (unsigned long n = 0; n < seconds; ++n)
+            sh.wheel.tick();
+        sh.lock.unlock();
+    }
+}
+
+void session_store::dump_stats()
+{
+    size_t live = 0;
+    unsigned long created = 0, expired = 0, rejected = 0;
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        shard &sh = m_shards[i];
+        sh.lock.lock();
+        live += sh.map.size();
+        created += sh.created;
+        expired += sh.expired;
+        rejected += sh.rejected;
+        sh.lock.unlock();
+    }
+    LOG_INFO("stats: sessions %zu live, %lu created, %lu expired, %lu rejected", live, created, expired, rejected);
+}
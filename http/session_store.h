@@ -0,0 +1,88 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "../timer/time_wheel_timer.h"
+
+#define SESSION_SHARD_BITS 4        //分片数的位数，用会话id的低几位选分片
+#define SESSION_SHARDS (1 << SESSION_SHARD_BITS)
+#define SESSION_MAX 65536           //会话总数上限，平均分给各分片
+#define SESSION_TIMEOUT 1800        //会话空闲超时的秒数，每次使用都会刷新
+#define SESSION_ID_LEN 32           //cookie里会话id的长度，128位随机数的十六进制
+#define SESSION_USER_LEN 100        //会话里记录的用户名最大长度
+
+// 登录会话表：登录成功后发一个随机的会话id作为cookie，之后带着cookie的请求查一次表就算已登录，
+// 不用再解析表单、比对密码
+// 按会话id分成SESSION_SHARDS个分片，每个分片一把锁、一张hash表和一个时间轮，
+// 过期靠时间轮，由一个reactor每秒调用tick推进；会话节点用完放回分片的空闲链表，每个分片最多SESSION_MAX / SESSION_SHARDS个，
+// 满了就不再发新会话(登录照常成功，只是下次还要输密码)，占用的内存有上限
+class session_store
+{
+public:
+    session_store();
+    ~session_store();
+
+    //为user新建会话，会话id写进sid(SESSION_ID_LEN + 1字节)，表满或取随机数失败返回false
+    bool create(const char *user, char *sid);
+    //sid是有效的会话就刷新超时并返回true，user不为空时拷出用户名(SESSION_USER_LEN字节)
+    //sid直接指向请求头里的cookie值，不要求以\0结尾
+    bool check(const char *sid, size_t len, char *user = NULL);
+    void remove(const char *sid, size_t len);
+    //走过seconds秒，到期的会话被删除，同一时刻只能有一个线程调用
+    void tick(unsigned long seconds);
+    void dump_stats();
+
+private:
+    struct session_id
+    {
+        uint64_t lo;
+        uint64_t hi;
+        bool operator==(const session_id &o) const
+        {
+            return lo == o.lo && hi == o.hi;
+        }
+    };
+    //会话id本来就是随机数，直接用它做hash
+    struct session_hash
+    {
+        size_t operator()(const session_id &id) const
+        {
+            return (size_t)id.hi;
+        }
+    };
+
+    struct shard;
+    struct session
+    {
+        session_id id;
+        shard *owner;
+        char user[SESSION_USER_LEN];
+        tw_timer<session> timer;
+        session *next_free;
+    };
+
+    //每个分片独占缓存行，不同分片的锁不会互相使对方的缓存失效
+    struct alignas(64) shard
+    {
+        shard() : free_list(NULL), allocated(0), created(0), expired(0), rejected(0) {}
+        locker lock;
+        std::unordered_map<session_id, session *, session_hash> map;
+        time_wheel<session> wheel;
+        session *free_list;
+        int allocated;          //已经分配过的节点数，不超过每个分片的上限
+        unsigned long created;
+        unsigned long expired;
+        unsigned long rejected; //表满没发出去的会话数
+    };
+
+    static bool parse_id(const char *sid, size_t len, session_id *id);
+    static void format_id(const session_id &id, char *sid);
+    static void expire(session *s);
+    static void release(session *s);
+
+    shard m_shards[SESSION_SHARDS];
+};
+
+#endif
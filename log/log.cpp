@@ -58,6 +58,7 @@ bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max
 
     m_today = my_tm.tm_mday;
 
+    strcpy(m_log_full_name, log_full_name);
     m_fp = fopen(log_full_name, "a");
     if (m_fp == NULL)
     {
@@ -117,6 +118,7 @@ void Log::write_log(int level, const char *format, ...)
         {
             snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
         }
+        strcpy(m_log_full_name, new_log);
         m_fp = fopen(new_log, "a");
     }
  
@@ -161,3 +163,17 @@ void Log::flush(void)
     fflush(m_fp);
     m_mutex.unlock();
 }
+
+//重新打开当前的日志文件，日志被logrotate挪走后收到SIGHUP时调用
+void Log::reopen(void)
+{
+    m_mutex.lock();
+    FILE *fp = fopen(m_log_full_name, "a");
+    if (fp != NULL)
+    {
+        fflush(m_fp);
+        fclose(m_fp);
+        m_fp = fp;
+    }
+    m_mutex.unlock();
+}
@@ -31,6 +31,8 @@ public:
 
     void flush(void);
 
+    void reopen(void);
+
 private:
     Log();
     virtual ~Log();
@@ -49,6 +51,7 @@ private:
 private:
     char dir_name[128]; //路径名
     char log_name[128]; //log文件名
+    char m_log_full_name[256]; //当前打开的日志文件的完整路径
     int m_split_lines;  //日志最大行数
     int m_log_buf_size; //日志缓冲区大小
     long long m_count;  //日志行数记录
@@ -8,21 +8,39 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
-#include <unordered_map>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <atomic>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
 #include "./lock/locker.h"
 #include "./threadpool/threadpool.h"
-#include "./timer/lst_timer.h"
+#include "./timer/time_wheel_timer.h"
 #include "./http/http_conn.h"
+#include "./http/http_scan.h"
 #include "./log/log.h"
 #include "./CGImysql/sql_connection_pool.h"
+#include "./CGImysql/user_store.h"
+#include "./affinity/affinity.h"
 
 #define MAX_FD 65536           //最大文件描述符
 #define MAX_EVENT_NUMBER 10000 //最大事件数
-#define TIMESLOT 5             //最小超时单位，5秒
+#define TIMESLOT 5             //超时单位，5秒
+#define TICK 1                 //时间轮每个tick 1秒，由timerfd驱动
+#define CONN_TIMEOUT (3 * TIMESLOT / TICK)      //连接空闲超时的tick数
+#define HANDSHAKE_TIMEOUT (TIMESLOT / TICK)     //TLS握手超时，到期还没握完就断开
+#define MAX_REACTOR 64         //最多的reactor线程数
+#define DB_LANE_LIMIT 4        //同时处理登录注册的线程数上限，其余线程留给静态请求
+#define LARGE_LANE_LIMIT 2     //同时从磁盘映射大文件的线程数上限
+#define USER_REFRESH_INTERVAL 60    //从数据库增量读新用户的间隔，秒
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
 
 #define SYNLOG  //同步写日志
 //#define ASYNLOG //异步写日志
@@ -35,30 +53,52 @@ extern int addfd(int epollfd, int fd, bool one_shot);
 extern int remove(int epollfd, int fd);
 extern int setnonblocking(int fd);
 
-//设置定时器相关参数
-static int pipefd[2];   //0是读端，1是写端
-static sort_timer_lst timer_lst;    //定时器容器类的对象
-
-static int epollfd = 0;
+//通过eventfd发给reactor的命令，按位或到reactor::cmds上
+#define CMD_STOP 1
 
-unordered_map<int, SSL*> fd2ssl;
-//信号处理函数,该信号来时候，系统调用将被中断，并执行该函数，
-//该函数只是简单通知主循环，并把信号值传递给主循环
-//执行步骤还是在主循环里，具体执行目标信号对应的逻辑
-//该函数往管道写入端写入信号值，主循环则从管道的读端读取该信号
-//只通过管道发送信号值，不处理信号对应的逻辑，缩短异步执行时间，减少对主程序的影响
-void sig_handler(int sig)
+// one loop per thread：每个reactor线程拥有自己的SO_REUSEPORT监听socket、epoll、eventfd、timerfd和时间轮，
+// 由内核把新连接分散到各个监听socket上，连接从accept到关闭都只在接收它的reactor里处理
+struct reactor
+{
+    int id;
+    int cpu;                    //绑定的CPU，-1表示不绑
+    pthread_t tid;
+    int listenfd;
+    int epollfd;
+    int wakefd;                 //eventfd，其他线程写它来唤醒本reactor
+    std::atomic<int> cmds;      //待处理的命令
+    std::atomic<unsigned long> accepted;    //本reactor接受的连接总数，供统计输出
+    int timerfd;                //每TICK秒可读一次，驱动时间轮
+    time_wheel<client_data> timer_wheel;   //定时器容器类的对象，只被本reactor线程访问
+    co_scheduler sched;         //在本reactor线程里恢复协程
+    epoll_event *events;
+};
+
+static reactor **reactors = NULL;   //每个reactor单独分配，放在它所绑核的NUMA节点上
+static int reactor_number = 1;
+
+//所有连接共用，以fd为下标，fd在进程内唯一，所以各reactor互不冲突
+//fd和reactor之间没有固定关系，没法按节点划分，所以按页在各NUMA节点间交错分配
+static http_conn *users = NULL;
+static client_data *users_timer = NULL;
+static threadpool<http_conn> *pool = NULL;
+static co_executor *offload = NULL;     //协程里阻塞的工作(数据库、读文件)在这里执行
+static SSL_CTX *ctx = NULL;
+static long long startup_us = 0;        //进程启动的时间，用来统计启动耗时
+static user_store *store = NULL;        //用户数据的后端
+
+//从别的线程(主线程的信号处理、工作线程)给reactor发命令：先记下命令，再写eventfd唤醒epoll_wait
+//一次唤醒可以带多个命令，reactor读eventfd时计数一并清零，不会有信号打断系统调用的问题
+void reactor_notify(reactor *r, int cmd)
 {
-    //为保证函数的可重入性，保留原来的errno（可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据）
-    //每种错误都有一个错误码与之对应，查看对应的错误码就知道发生什么错误了
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0);    //将信号值写入管道(char*型)，因为epoll一直在监听pipefd[0]读端，一有信号就会传递给主循环
-    errno = save_errno;
+    r->cmds.fetch_or(cmd);
+    uint64_t one = 1;
+    ssize_t n = write(r->wakefd, &one, sizeof(one));
+    (void)n;
 }
 
-
-//设置信号函数,告诉系统处理函数要处理哪些信号(SIGPIPE，SIGALRM，SIGTERM)，以及谁来处理(sig_handler()来处理)
+//设置信号函数,告诉系统处理函数要处理哪些信号，以及谁来处理，现在只用来忽略SIGPIPE
+//其余的信号都被屏蔽，由主线程从signalfd里同步读取
 void addsig(int sig, void(handler)(int), bool restart = true)
 {
     struct sigaction sa;
@@ -71,28 +111,48 @@ void addsig(int sig, void(handler)(int), bool restart = true)
     assert(sigaction(sig, &sa, NULL) != -1);    //检查或修改 与指定信号相关联的处理动作
 }
 
-//定时处理任务，每隔 TIMESLOT = 5 秒给这个函数的进程发送一个SIGALRM信号
+//定时处理任务，timerfd每TICK秒可读一次，读出这段时间过去的tick数，时间轮走相应的步数
 // 定时器模块的功能是定时检查长时间无反应的连接，如果有服务器这边就主动断开连接。
-void timer_handler()
+void timer_handler(reactor *r)
 {
-    timer_lst.tick();   //tick()才是真正的处理定时器处理函数
-    alarm(TIMESLOT);    //alarm(5)表示5秒之后给程序发送一个 SIGALRM 信号，接到SIGALRM后又会调用这个函数，形成循环
+    uint64_t ticks = 0;
+    if (read(r->timerfd, &ticks, sizeof(ticks)) != sizeof(ticks))
+        return;
+    //会话表各reactor共用，只由reactor 0推进
+    if (r->id == 0)
+        http_conn::m_sessions.tick(ticks * TICK);
+    while (ticks--)
+        r->timer_wheel.tick();
+}
 
-    // 信号处理函数利用管道通知主循环，主循环接收到信号后，会对升序链表上所有定时器进行处理，
-    // 若该段时间内没有交换数据，则关闭连接释放资源
+//创建并启动周期性的timerfd，代替alarm和SIGALRM，不再打断系统调用
+int open_timerfd()
+{
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(timerfd != -1);
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = TICK;
+    its.it_interval.tv_sec = TICK;
+    int ret = timerfd_settime(timerfd, 0, &its, NULL);
+    assert(ret != -1);
+    return timerfd;
 }
 
 //定时器回调函数(信号处理函数)，删除非活动连接在socket上的注册事件，并关闭
+//统一走close_conn，连接持有的SSL对象也在那里释放
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);    // 删除注册在epoll上的非活动连接socket
-    assert(user_data);  
-    close(user_data->sockfd);      //关闭文件描述符
-    http_conn::m_user_count--;      //连接数减一
-    LOG_INFO("close fd %d", user_data->sockfd);
+    assert(user_data);
+    int sockfd = user_data->sockfd;
+    //连接在协程或工作线程手里，通知它们收尾，关掉socket后由EPOLLHUP关闭连接
+    if (users[sockfd].co_cancel() || users[sockfd].pool_cancel())
+        return;
+    LOG_INFO("close fd %d", sockfd);
     Log::get_instance()->flush();
+    users[sockfd].close_conn();  // 删除注册在epoll上的非活动连接socket，关闭文件描述符，连接数减一；之后users_timer[sockfd]可能已经属于新连接
 }
- 
+
 void show_error(int connfd, const char *info)
 {
     printf("%s", info);
@@ -100,101 +160,11 @@ void show_error(int connfd, const char *info)
     close(connfd);
 }
 
-int main(int argc, char *argv[])
+//创建一个开启SO_REUSEPORT的监听socket，每个reactor一个，内核按四元组哈希把连接分给它们
+//reactor绑了核时再设置SO_INCOMING_CPU，内核优先把连接交给和收包CPU相同的监听socket，
+//连接的软中断、accept和之后的读写都在同一个核上
+int open_listenfd(int port, int cpu)
 {
-    printf("start!!\n");
-    
-#ifdef ASYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 8); //异步日志模型
-#endif
-
-#ifdef SYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 0); //同步日志模型.
-#endif
-    if (argc <= 1)
-    {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
-        return 1;
-    }
-
-    int port = atoi(argv[1]);
-
-    //往一个读端关闭的管道或socket连接中写数据时，将引发SIGPIPE信号。
-    //需要捕获它并处理，至少也得忽略它。因为程序收到SIGPIPE信号会默认结束该进程
-    //我们不希望应为错误的写操作导致程序退出
-    addsig(SIGPIPE, SIG_IGN);   //SIG_IGN表示信号处理函数为忽略处理
-
-
-    //创建数据库连接池
-    connection_pool *connPool = connection_pool::GetInstance();
-    printf("init\n");
-    connPool->init("127.0.0.1", "root", "746f7657465952fd", "yourdb", 3306, 8);
-    printf("database connected! \n");
-
-    //创建线程池，里面的线程一直在while(1)死循环，阻塞等待信号量大于0，就代表任务来了把信号量先减1然后去执行任务(且这个操作加了锁，保证只有一个线程去干)
-    //线程池可以避免线程的频繁创建和销毁。新建立连接时，将已连接的socket放入到一个队列里面，然后线程池的线程负责从队列中取出来进行处理
-    //队列是全局的，每个线程都会操作，为避免多线程竞争，线程在操作这个队列前要加锁
-    threadpool<http_conn> *pool = NULL;
-    try
-    {
-        pool = new threadpool<http_conn>(connPool);
-    }
-    catch (...)
-    {
-        return 1;
-    }
-
-    http_conn *users = new http_conn[MAX_FD];   // http对象，一开始就创建65536个？
-    assert(users);
-
-
-    printf("threadpool create! \n");
-    //初始化数据库读取表
-    users->initmysql_result(connPool);
-
-/***************************SSL初始化*******************************************/
-    /* SSL 库初始化 */
-    SSL_library_init();
-    /* 载入所有 SSL 算法 */
-    OpenSSL_add_all_algorithms();
-    /* 载入所有 SSL 错误消息 */
-    SSL_load_error_strings();
-    /* 以 SSL V2 和 V3 标准兼容方式产生一个 SSL_CTX ，即 SSL Content Text */
-    // SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
-    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
-
-
-    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL); 
-
-    /* 也可以用 SSLv2_server_method() 或 SSLv3_server_method() 单独表示 V2 或 V3标准 */
-    if (ctx == NULL) {
-        ERR_print_errors_fp(stdout);
-        exit(1);
-    }
-    /* 载入用户的数字证书， 此证书用来发送给客户端。 证书里包含有公钥 */
-    // if (SSL_CTX_use_certificate_chain_file(ctx, argv[4]) <= 0) {
-    if (SSL_CTX_use_certificate_file(ctx, "../certification/certificate.pem", SSL_FILETYPE_PEM) <= 0) {
-        printf("读取证书失败");
-        ERR_print_errors_fp(stdout);
-        exit(1);
-    }
-    
-    /* 载入用户私钥 */
-    if (SSL_CTX_use_PrivateKey_file(ctx, "../certification/private.key", SSL_FILETYPE_PEM) <= 0) {
-        printf("读取私钥失败");
-        ERR_print_errors_fp(stdout);
-        exit(1);
-    }
-    /* 检查用户私钥是否正确 */
-    if (!SSL_CTX_check_private_key(ctx)) {
-        ERR_print_errors_fp(stdout);
-        exit(1);
-    }
-
-    SSL_CTX_set_cipher_list (ctx, "RC4-MD5");
-    SSL_CTX_set_mode (ctx, SSL_MODE_AUTO_RETRY);
-
-/********************************************************************/
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
 
@@ -211,40 +181,30 @@ int main(int argc, char *argv[])
 
     int flag = 1;
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+    if (cpu >= 0 && setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+        LOG_ERROR("set SO_INCOMING_CPU %d failure, errno is:%d", cpu, errno);
     ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
     ret = listen(listenfd, 5);
     assert(ret >= 0);
-/********************************************************************/
-
-
-    //创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
-    assert(epollfd != -1);
+    return listenfd;
+}
 
-    //往epoll内核时间表中注册socket，当listen到新连接时，
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
+//每个reactor线程的事件循环
+void *eventloop(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    int listenfd = r->listenfd;
+    int epollfd = r->epollfd;
+    epoll_event *events = r->events;
+    time_wheel<client_data> &timer_wheel = r->timer_wheel;
 
-    //创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    setnonblocking(pipefd[1]);  //设置管道写端为非阻塞，阻塞(先读/写的话，必须等到有东西(另一端写/读)否则阻塞)
-    addfd(epollfd, pipefd[0], false);   // 管道读端加入epoll,开始监听
+    if (r->cpu >= 0 && !pin_thread(r->cpu))
+        LOG_ERROR("reactor %d pin to cpu %d failure", r->id, r->cpu);
 
-    //设置信号处理的函数，只处理alarm和terminal，（唤醒和终止）两种情况
-    //这里指定信号处理函数为自定的信号处理函数sig_handler，有这两种信号来得时候，会中断调用sig_handler
-    addsig(SIGALRM, sig_handler, false);    //由alarm或setitimer设置的时钟超时引起的
-    addsig(SIGTERM, sig_handler, false);    //终止进程，kill命令发送的就是SIGTERM
     bool stop_server = false;
-
-    client_data *users_timer = new client_data[MAX_FD];
-
     bool timeout = false;
-    
-    //开始每隔5秒进行超时检测
-    alarm(TIMESLOT);
 
     while (!stop_server)
     {
@@ -259,11 +219,11 @@ int main(int argc, char *argv[])
             LOG_ERROR("%s", "epoll failure");
             break;
         }
-        for (int i = 0; i < number; i++)    
+        for (int i = 0; i < number; i++)
         {
             int sockfd = events[i].data.fd;
 
-            //处理新到的客户连接 
+            //处理新到的客户连接
             if (sockfd == listenfd)
             {
                 struct sockaddr_in client_address;
@@ -281,37 +241,25 @@ int main(int argc, char *argv[])
                     LOG_ERROR("%s", "Internal server busy");
                     continue;
                 }
+                r->accepted.fetch_add(1, std::memory_order_relaxed);
 
                  /* 基于 ctx 产生一个新的 SSL */
                 SSL* ssl = SSL_new(ctx);
                 /* 将连接用户的 socket 加入到 SSL */
                 SSL_set_fd(ssl, connfd);
-                /* 建立 SSL 连接 */
-                if (SSL_accept(ssl) == -1) 
-                {
-                    printf("ssl_accept错误\n");
-                    perror("accept");
-                    // close(connfd);
-                    continue;
-                }
-                else
-                {
-                    printf("连接成功\n");
-                }
-                fd2ssl[connfd] = ssl;
-                users[connfd].init(connfd, client_address); //初始化socket地址(协议族，ip，端口号)，把事件注册到epoll上，然后初始化一堆数据
+                /* 握手不在这里阻塞完成，只设为服务端模式，之后由epoll事件驱动do_handshake() */
+                SSL_set_accept_state(ssl);
+                users[connfd].init(connfd, client_address, epollfd, ssl, &r->sched); //初始化socket地址(协议族，ip，端口号)，把事件注册到本reactor的epoll上，然后初始化一堆数据
 
                 //初始化client_data数据
-                //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+                //设置嵌在client_data里的定时器的回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
+                //握手阶段用较短的超时，防止慢速或恶意客户端一直占着连接
                 users_timer[connfd].address = client_address;
                 users_timer[connfd].sockfd = connfd;
-                util_timer *timer = new util_timer;
+                tw_timer<client_data> *timer = &users_timer[connfd].timer;
                 timer->user_data = &users_timer[connfd];
                 timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                users_timer[connfd].timer = timer;
-                timer_lst.add_timer(timer);
+                timer_wheel.add_timer(timer, HANDSHAKE_TIMEOUT);
 #endif
 
 #ifdef listenfdET
@@ -329,142 +277,449 @@ int main(int argc, char *argv[])
                         LOG_ERROR("%s", "Internal server busy");
                         break;
                     }
-                    users[connfd].init(connfd, client_address);
+                    SSL* ssl = SSL_new(ctx);
+                    SSL_set_fd(ssl, connfd);
+                    SSL_set_accept_state(ssl);
+                    users[connfd].init(connfd, client_address, epollfd, ssl, &r->sched);
 
                     //初始化client_data数据
-                    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+                    //设置嵌在client_data里的定时器的回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
                     users_timer[connfd].address = client_address;
                     users_timer[connfd].sockfd = connfd;
-                    util_timer *timer = new util_timer;
+                    tw_timer<client_data> *timer = &users_timer[connfd].timer;
                     timer->user_data = &users_timer[connfd];
                     timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
+                    timer_wheel.add_timer(timer, HANDSHAKE_TIMEOUT);
                 }
                 continue;
 #endif
             }
 
+            //有协程在等这个fd，由协程处理，出错时协程自己收尾
+            else if (r->sched.has_waiter(sockfd))
+            {
+                users[sockfd].set_in_pool(false);
+                if (users[sockfd].co_owned() && !(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    timer_wheel.adjust_timer(&users_timer[sockfd].timer, CONN_TIMEOUT);
+                r->sched.wake_fd(sockfd, events[i].events);
+            }
+
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
+                users[sockfd].set_in_pool(false);
                 //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
+                tw_timer<client_data> *timer = &users_timer[sockfd].timer;
+                timer_wheel.del_timer(timer);
                 timer->cb_func(&users_timer[sockfd]);
+            }
 
-                if (timer)
-                {
-                    timer_lst.del_timer(timer);
-                }
+            //时间轮的tick，等这批事件都处理完再走
+            //到期的连接会被关闭，同一批里后面可能还有这个fd的事件，fd也可能已经被别的reactor重新accept
+            else if (sockfd == r->timerfd)
+            {
+                timeout = true;
             }
 
-            //处理信号
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
+            //处理其他线程发来的命令
+            else if (sockfd == r->wakefd)
             {
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0); //ret正常情况下都是1，即收到的信号长度是1
-                if (ret == -1)
-                {
+                uint64_t count;
+                if (read(r->wakefd, &count, sizeof(count)) != sizeof(count))
                     continue;
+                int cmds = r->cmds.exchange(0);
+                if (cmds & CMD_STOP)
+                {
+                    stop_server = true;
                 }
-                else if (ret == 0)
+                r->sched.run_ready();   //其他线程交回来的协程
+            }
+
+            //TLS握手还没完成，读写事件都用来推进握手
+            else if (users[sockfd].is_handshaking())
+            {
+                tw_timer<client_data> *timer = &users_timer[sockfd].timer;
+                http_conn::HANDSHAKE_STATUS hs = users[sockfd].do_handshake();
+                if (hs == http_conn::HANDSHAKE_ERROR)
                 {
-                    continue;
+                    timer_wheel.del_timer(timer);
+                    timer->cb_func(&users_timer[sockfd]);
                 }
-                else
+                else if (hs == http_conn::HANDSHAKE_OK)
                 {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
+                    //握手完成，换成正常连接的超时时间
+                    timer_wheel.adjust_timer(timer, CONN_TIMEOUT);
                 }
             }
 
             //处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
-                util_timer *timer = users_timer[sockfd].timer;
+                users[sockfd].set_in_pool(false);   //有事件说明工作线程已经把连接交回来了
+                tw_timer<client_data> *timer = &users_timer[sockfd].timer;
                 if (users[sockfd].read_once())
                 {
                     LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
                     Log::get_instance()->flush();
                     //若监测到读事件，将该事件放入请求队列
-                    pool->append(users + sockfd);
-
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
+                    //队列满了就在这里直接回503，不让请求悄悄丢掉、连接挂到超时
+                    if (!pool->append(users + sockfd))
                     {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        LOG_WARN("request queue full, reject the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+                        if (!users[sockfd].reject())
+                        {
+                            timer_wheel.del_timer(timer);
+                            timer->cb_func(&users_timer[sockfd]);
+                        }
+                        continue;
                     }
-                }   
+                    users[sockfd].set_in_pool(true);
+
+                    //若有数据传输，则将定时器往后延迟3个单位
+                    //时间轮上摘下再挂到新的槽，O(1)
+                    timer_wheel.adjust_timer(timer, CONN_TIMEOUT);
+                    LOG_INFO("%s", "adjust timer once");
+                    Log::get_instance()->flush();
+                }
                 else    //这里本应该会读到东西的，没读到说明出错了，直接删除这个事件(自己猜想)
                 {
+                    timer_wheel.del_timer(timer);
                     timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
                 }
             }
             else if (events[i].events & EPOLLOUT)
             {
-                util_timer *timer = users_timer[sockfd].timer;
+                users[sockfd].set_in_pool(false);
+                tw_timer<client_data> *timer = &users_timer[sockfd].timer;
                 if (users[sockfd].write())
                 {
                     LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
                     Log::get_instance()->flush();
 
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
+                    //流水线上的下一个请求已经在读缓冲区里，不会再有EPOLLIN，直接放入请求队列
+                    bool pipelined = users[sockfd].pipelined();
+                    if (pipelined && !pool->append(users + sockfd))
                     {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        LOG_WARN("request queue full, reject the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+                        if (!users[sockfd].reject())
+                        {
+                            timer_wheel.del_timer(timer);
+                            timer->cb_func(&users_timer[sockfd]);
+                        }
+                        continue;
                     }
+                    users[sockfd].set_in_pool(pipelined);   //放进线程池之后连接就归工作线程，不能再读它的状态
+
+                    //若有数据传输，则将定时器往后延迟3个单位
+                    //时间轮上摘下再挂到新的槽，O(1)
+                    timer_wheel.adjust_timer(timer, CONN_TIMEOUT);
+                    LOG_INFO("%s", "adjust timer once");
+                    Log::get_instance()->flush();
                 }
                 else    //同理，这里本应该可以写东西的，没写到说明出错了，直接删除这个事件(自己猜想)
                 {
+                    timer_wheel.del_timer(timer);
                     timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
                 }
             }
         }
         if (timeout)
         {
-            timer_handler();
+            timer_handler(r);
             timeout = false;
         }
     }
-    close(epollfd);
-    close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    return r;
+}
+
+//用户数据的后端在后台准备：MySQL时并行建立连接池，再读入用户表，都好了才放行登录注册
+//监听不等它，静态文件在这期间照常服务；后端不可用时每隔一秒重试，直到读到用户表
+//之后这个线程留下来，定时从后端增量读别的实例注册的用户
+void *warm_up(void *)
+{
+    while (!store->open())
+        sleep(1);
+    LOG_INFO("user store ready after %lld ms", (monotonic_us() - startup_us) / 1000);
+    while (!http_conn::load_users())
+        sleep(1);
+    http_conn::m_db_ready.store(true, std::memory_order_release);
+    LOG_INFO("database routes ready after %lld ms", (monotonic_us() - startup_us) / 1000);
+    Log::get_instance()->flush();
+    http_conn::save_users();
+    while (true)
+    {
+        sleep(USER_REFRESH_INTERVAL);
+        http_conn::load_users();
+    }
+    return NULL;
+}
+
+//输出运行统计，收到SIGUSR1时调用
+void dump_stats()
+{
+    LOG_INFO("stats: %d connection(s)", (int)http_conn::m_user_count);
+    for (int i = 0; i < reactor_number; ++i)
+        LOG_INFO("stats: reactor %d accepted %lu", i, reactors[i]->accepted.load(std::memory_order_relaxed));
+    pool->dump_stats();
+    if (offload)
+        offload->dump_stats("offload");
+    store->dump_stats();
+    http_conn::m_sessions.dump_stats();
+    Log::get_instance()->flush();
+}
+
+//主线程的控制循环，从signalfd里同步地读信号，直到收到SIGTERM
+void control_loop(int sigfd)
+{
+    bool stop_server = false;
+    while (!stop_server)
+    {
+        struct signalfd_siginfo si;
+        if (read(sigfd, &si, sizeof(si)) != sizeof(si))
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("%s", "signalfd read failure");
+            break;
+        }
+        switch (si.ssi_signo)
+        {
+        case SIGTERM:
+        {
+            stop_server = true;
+            break;
+        }
+        case SIGHUP:
+        {
+            Log::get_instance()->reopen();
+            LOG_INFO("%s", "log reopened");
+            break;
+        }
+        case SIGUSR1:
+        {
+            dump_stats();
+            break;
+        }
+        }
+    }
+    for (int i = 0; i < reactor_number; ++i)
+        reactor_notify(reactors[i], CMD_STOP);
+}
+
+int main(int argc, char *argv[])
+{
+    startup_us = monotonic_us();
+    printf("start!!\n");
+
+    //在创建任何线程之前屏蔽这几个信号，之后创建的线程都继承这个屏蔽字，
+    //信号只会排队在signalfd上，由主线程同步读取，epoll_wait不会再被EINTR打断
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGTERM);   //终止进程，kill命令发送的就是SIGTERM
+    sigaddset(&sigmask, SIGHUP);    //重新打开日志文件
+    sigaddset(&sigmask, SIGUSR1);   //输出运行统计
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+#ifdef ASYNLOG
+    Log::get_instance()->init("ServerLog", 2000, 800000, 8); //异步日志模型
+#endif
+
+#ifdef SYNLOG
+    Log::get_instance()->init("ServerLog", 2000, 800000, 0); //同步日志模型.
+#endif
+    if (argc <= 1)
+    {
+        printf("usage: %s port_number [reactor_number] [reactor_cpus] [worker_cpus] [user_store] [data_dir]\n", basename(argv[0]));
+        return 1;
+    }
+
+    int port = atoi(argv[1]);
+    if (argc > 2)
+        reactor_number = atoi(argv[2]); //reactor线程数，一般设为核数
+    if (reactor_number <= 0 || reactor_number > MAX_REACTOR)
+    {
+        printf("reactor_number must be in [1, %d]\n", MAX_REACTOR);
+        return 1;
+    }
+    //绑核的CPU列表，格式同taskset -c，如0-3,8；不给或者给"-"就不绑，由调度器决定
+    //reactor i绑到reactor_cpus[i % n]，工作线程i绑到worker_cpus[i % n]
+    std::vector<int> reactor_cpus, worker_cpus;
+    if ((argc > 3 && strcmp(argv[3], "-") != 0 && !parse_cpu_list(argv[3], reactor_cpus)) ||
+        (argc > 4 && strcmp(argv[4], "-") != 0 && !parse_cpu_list(argv[4], worker_cpus)))
+    {
+        printf("bad cpu list, expect something like 0-3,8\n");
+        return 1;
+    }
+    //用户数据的后端：mysql(默认)，或者mem:N在进程内生成N个用户，不需要数据库
+    store = user_store::create(argc > 5 ? argv[5] : "mysql");
+    if (!store)
+    {
+        printf("bad user store, expect mysql or mem:N\n");
+        return 1;
+    }
+    //用户快照放在数据目录下，里面有明文密码，目录不存在就建一个只有自己能进的
+    const char *data_dir = argc > 6 ? argv[6] : ".";
+    if (mkdir(data_dir, 0700) != 0 && errno != EEXIST)
+    {
+        printf("cannot create data directory %s: %s\n", data_dir, strerror(errno));
+        return 1;
+    }
+    store->set_data_dir(data_dir);
+    http_conn::m_store = store;
+
+    //往一个读端关闭的管道或socket连接中写数据时，将引发SIGPIPE信号。
+    //需要捕获它并处理，至少也得忽略它。因为程序收到SIGPIPE信号会默认结束该进程
+    //我们不希望应为错误的写操作导致程序退出
+    addsig(SIGPIPE, SIG_IGN);   //SIG_IGN表示信号处理函数为忽略处理
+
+
+    //创建线程池，里面的线程一直在while(1)死循环，阻塞等待信号量大于0，就代表任务来了把信号量先减1然后去执行任务(且这个操作加了锁，保证只有一个线程去干)
+    //线程池可以避免线程的频繁创建和销毁。新建立连接时，将已连接的socket放入到一个队列里面，然后线程池的线程负责从队列中取出来进行处理
+    //队列是全局的，每个线程都会操作，为避免多线程竞争，线程在操作这个队列前要加锁
+    try
+    {
+        pool = new threadpool<http_conn>(8, 10000, 64, worker_cpus);
+        pool->set_lane_limit(http_conn::LANE_DB, DB_LANE_LIMIT);
+        pool->set_lane_limit(http_conn::LANE_LARGE, LARGE_LANE_LIMIT);
+#ifdef CO_HANDLER
+        //协程的阻塞工作单独一个小线程池，协程挂起时不占reactor和工作线程
+        offload = new co_executor(4, 10000, 16, worker_cpus);
+        http_conn::m_offload = offload;
+#endif
+    }
+    catch (...)
+    {
+        return 1;
+    }
+
+    users = numa_new_array<http_conn>(MAX_FD);   // http对象，一开始就创建65536个
+    assert(users);
+
+
+    printf("threadpool create! \n");
+
+/***************************SSL初始化*******************************************/
+    /* SSL 库初始化 */
+    SSL_library_init();
+    /* 载入所有 SSL 算法 */
+    OpenSSL_add_all_algorithms();
+    /* 载入所有 SSL 错误消息 */
+    SSL_load_error_strings();
+    /* 以 SSL V2 和 V3 标准兼容方式产生一个 SSL_CTX ，即 SSL Content Text */
+    // SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+    ctx = SSL_CTX_new(TLS_server_method());
+
+
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+    /* 也可以用 SSLv2_server_method() 或 SSLv3_server_method() 单独表示 V2 或 V3标准 */
+    if (ctx == NULL) {
+        ERR_print_errors_fp(stdout);
+        exit(1);
+    }
+    /* 载入用户的数字证书， 此证书用来发送给客户端。 证书里包含有公钥 */
+    // if (SSL_CTX_use_certificate_chain_file(ctx, argv[4]) <= 0) {
+    if (SSL_CTX_use_certificate_file(ctx, "../certification/certificate.pem", SSL_FILETYPE_PEM) <= 0) {
+        printf("读取证书失败");
+        ERR_print_errors_fp(stdout);
+        exit(1);
+    }
+
+    /* 载入用户私钥 */
+    if (SSL_CTX_use_PrivateKey_file(ctx, "../certification/private.key", SSL_FILETYPE_PEM) <= 0) {
+        printf("读取私钥失败");
+        ERR_print_errors_fp(stdout);
+        exit(1);
+    }
+    /* 检查用户私钥是否正确 */
+    if (!SSL_CTX_check_private_key(ctx)) {
+        ERR_print_errors_fp(stdout);
+        exit(1);
+    }
+
+    SSL_CTX_set_cipher_list (ctx, "RC4-MD5");
+    //write()每次重试都会重新拼接发送缓冲区，需要允许缓冲区地址变化和部分写
+    SSL_CTX_set_mode (ctx, SSL_MODE_AUTO_RETRY | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+/********************************************************************/
+    users_timer = numa_new_array<client_data>(MAX_FD);
+    assert(users_timer);
+    reactors = new reactor *[reactor_number];
+    for (int i = 0; i < reactor_number; ++i)
+    {
+        int cpu = reactor_cpus.empty() ? -1 : reactor_cpus[i % reactor_cpus.size()];
+        //reactor结构(含时间轮)和事件数组只被本reactor线程访问，分配在它所绑核的节点上
+        numa_scope scope(cpu < 0 ? -1 : cpu_node(cpu));
+        reactor *r = new reactor;
+        reactors[i] = r;
+        r->id = i;
+        r->cpu = cpu;
+        r->listenfd = open_listenfd(port, cpu);
+
+        //创建内核事件表
+        r->events = new epoll_event[MAX_EVENT_NUMBER];
+        r->epollfd = epoll_create(5);
+        assert(r->epollfd != -1);
+
+        //往epoll内核时间表中注册socket，当listen到新连接时，
+        addfd(r->epollfd, r->listenfd, false);
+
+        //创建eventfd，其他线程通过它唤醒本reactor
+        r->cmds = 0;
+        r->accepted = 0;
+        r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(r->wakefd != -1);
+        addfd(r->epollfd, r->wakefd, false);
+        r->sched.init(r->epollfd, r->wakefd, MAX_FD);
+
+        r->timerfd = open_timerfd();
+        addfd(r->epollfd, r->timerfd, false);
+    }
+
+    int sigfd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+    assert(sigfd != -1);
+
+    for (int i = 0; i < reactor_number; ++i)
+    {
+        if (pthread_create(&reactors[i]->tid, NULL, eventloop, reactors[i]) != 0)
+        {
+            LOG_ERROR("%s", "create reactor thread failure");
+            return 1;
+        }
+    }
+    printf("%d reactor(s) running\n", reactor_number);
+    LOG_INFO("listening on port %d after %lld ms", port, (monotonic_us() - startup_us) / 1000);
+    LOG_INFO("http scanner: %s", http_scan_impl());
+
+    //监听已经打开，用户数据的后端和用户表在后台准备
+    pthread_t warm_tid;
+    if (pthread_create(&warm_tid, NULL, warm_up, NULL) != 0)
+    {
+        LOG_ERROR("%s", "create warm up thread failure");
+        return 1;
+    }
+    pthread_detach(warm_tid);
+
+    //主线程只负责控制面：处理信号，需要时通过eventfd通知各个reactor
+    control_loop(sigfd);
+
+    for (int i = 0; i < reactor_number; ++i)
+        pthread_join(reactors[i]->tid, NULL);
+    close(sigfd);
+    store->close();     //排队的注册写完再退出
+
+    for (int i = 0; i < reactor_number; ++i)
+    {
+        close(reactors[i]->epollfd);
+        close(reactors[i]->listenfd);
+        close(reactors[i]->wakefd);
+        close(reactors[i]->timerfd);
+        delete[] reactors[i]->events;
+        delete reactors[i];
+    }
+    delete[] reactors;
+    numa_delete_array(users, MAX_FD);
+    numa_delete_array(users_timer, MAX_FD);
     delete pool;
-    return 0;
+    delete offload;
+    return 0;   //store不释放，后台的warm_up线程可能还在用
 }
@@ -0,0 +1,148 @@
+// 连接池取连接的争用：threads个线程模拟工作线程处理请求，其中db_percent%是要用数据库的请求(持有连接hold_us微秒)，
+// 其余是静态请求(只占CPU static_us微秒)，分两种方式各跑seconds秒：
+//   every：每个请求都先取一个连接(原来线程池里用connectionRAII包住process()的做法)
+//   db：只有数据库请求取连接(现在的做法)
+// 输出每秒处理的请求数、静态请求延迟的p50/p99和取连接超时的次数，连接池自己的等待直方图写在日志里
+// 需要一个能连上的MySQL，用法：./checkout_bench url user password db port [threads] [pool] [db_percent] [seconds] [hold_us] [static_us]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "../../CGImysql/sql_connection_pool.h"
+#include "../../log/log.h"
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//占着CPU，不让出线程，模拟处理静态请求
+static void busy_for(long us)
+{
+    long long end = now_us() + us;
+    while (now_us() < end)
+        ;
+}
+
+struct bench_args
+{
+    connection_pool *pool;
+    bool checkout_every;
+    int db_percent;
+    long hold_us;
+    long static_us;
+    long long deadline;
+    unsigned int seed;
+    long requests;
+    long timeouts;
+    std::vector<int> static_latency;
+};
+
+static void *worker(void *arg)
+{
+    bench_args *a = (bench_args *)arg;
+    while (now_us() < a->deadline)
+    {
+        bool db = (int)(rand_r(&a->seed) % 100) < a->db_percent;
+        long long start = now_us();
+        MYSQL *con = NULL;
+        if (db || a->checkout_every)
+        {
+            con = a->pool->GetConnection();
+            if (!con)
+            {
+                ++a->timeouts;
+                continue;
+            }
+        }
+        if (db)
+            usleep(a->hold_us);
+        else
+            busy_for(a->static_us);
+        if (con)
+            a->pool->ReleaseConnection(con);
+        if (!db)
+            a->static_latency.push_back((int)(now_us() - start));
+        ++a->requests;
+    }
+    return NULL;
+}
+
+static void run(connection_pool *pool, const char *name, bool checkout_every, int threads, int db_percent, int seconds, long hold_us, long static_us)
+{
+    std::vector<bench_args> args(threads);
+    std::vector<pthread_t> tids(threads);
+    long long deadline = now_us() + seconds * 1000000LL;
+    for (int i = 0; i < threads; ++i)
+    {
+        args[i].pool = pool;
+        args[i].checkout_every = checkout_every;
+        args[i].db_percent = db_percent;
+        args[i].hold_us = hold_us;
+        args[i].static_us = static_us;
+        args[i].deadline = deadline;
+        args[i].seed = i + 1;
+        args[i].requests = 0;
+        args[i].timeouts = 0;
+        pthread_create(&tids[i], NULL, worker, &args[i]);
+    }
+    long requests = 0, timeouts = 0;
+    std::vector<int> latency;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        requests += args[i].requests;
+        timeouts += args[i].timeouts;
+        latency.insert(latency.end(), args[i].static_latency.begin(), args[i].static_latency.end());
+    }
+    std::sort(latency.begin(), latency.end());
+    int p50 = latency.empty() ? 0 : latency[latency.size() / 2];
+    int p99 = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+    printf("%-6s %8.0f req/s  static p50 %6dus p99 %6dus  %ld checkout timeouts\n", name, (double)requests / seconds, p50, p99, timeouts);
+    pool->dump_stats();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 6)
+    {
+        printf("usage: %s url user password db port [threads] [pool] [db_percent] [seconds] [hold_us] [static_us]\n", argv[0]);
+        return 1;
+    }
+    int threads = argc > 6 ? atoi(argv[6]) : 32;
+    int pool_size = argc > 7 ? atoi(argv[7]) : 8;
+    int db_percent = argc > 8 ? atoi(argv[8]) : 5;
+    int seconds = argc > 9 ? atoi(argv[9]) : 5;
+    long hold_us = argc > 10 ? atol(argv[10]) : 2000;
+    long static_us = argc > 11 ? atol(argv[11]) : 20;
+    if (threads <= 0 || pool_size <= 0 || db_percent < 0 || db_percent > 100 || seconds <= 0)
+    {
+        printf("bad arguments\n");
+        return 1;
+    }
+
+    Log::get_instance()->init("./checkout_bench_log", 2000, 800000, 0);
+    connection_pool *pool = connection_pool::GetInstance();
+    pool->init(argv[1], argv[2], argv[3], argv[4], atoi(argv[5]), pool_size, pool_size);
+    //连接在后台并行建立，等它们都好了再开始
+    for (int i = 0; i < 100 && pool->GetFreeConn() < pool_size; ++i)
+        usleep(100 * 1000);
+    if (pool->GetFreeConn() < pool_size)
+    {
+        printf("only %d of %d connections to the database\n", pool->GetFreeConn(), pool_size);
+        return 1;
+    }
+
+    printf("threads %d, pool %d, db requests %d%%, hold %ldus, static %ldus\n", threads, pool_size, db_percent, hold_us, static_us);
+    run(pool, "every", true, threads, db_percent, seconds, hold_us, static_us);
+    run(pool, "db", false, threads, db_percent, seconds, hold_us, static_us);
+    pool->DestroyPool();
+    return 0;
+}
@@ -0,0 +1,229 @@
+// 线程池请求队列的吞吐对比，三种队列都按线程池里的用法来取：
+//   sem_queue：原来threadpool里的做法，list+互斥锁，append后sem post，工作线程sem wait后加锁取
+//   locked_queue：list+互斥锁(现在默认的work_queue)，取不到先自旋SPIN_COUNT次，再登记休眠等信号量
+//   mpmc_queue：无锁环形队列(定义LOCKFREE_QUEUE时的work_queue)，等待方式同上
+// producers个线程一共push items个指针，consumers个线程一起pop，满了就让出CPU重试，
+// 统计全部取完的时间，按每秒操作数(一次push加一次pop算一次)输出，同时核对取出的值没有丢失或重复
+// 不给线程数时生产者和消费者各取1、2、4…64，两两组合都跑一遍
+// 用法：./queue_bench [items] [capacity] [producers consumers]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <vector>
+#include "../../threadpool/threadpool.h"
+#include "../../threadpool/mpmc_queue.h"
+#include "../../threadpool/locked_queue.h"
+
+#define MAX_THREADS 64
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 原来threadpool的append和run里的队列操作，满了返回false，pop在信号量上阻塞
+class sem_queue
+{
+public:
+    sem_queue(size_t max_requests) : m_max_requests(max_requests) {}
+    bool push(int *request)
+    {
+        m_queuelocker.lock();
+        if (m_workqueue.size() >= m_max_requests)
+        {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+    void pop(int *&request)
+    {
+        while (true)
+        {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_workqueue.empty())
+            {
+                m_queuelocker.unlock();
+                continue;
+            }
+            request = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+            return;
+        }
+    }
+
+private:
+    size_t m_max_requests;
+    std::list<int *> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+};
+
+// 给不阻塞的队列加上线程池的等待方式：先自旋，再登记为休眠者后取一次，还取不到才等信号量
+// push在有休眠者时post，和threadpool::run/wake的顺序一样，不会丢唤醒
+template <class Q>
+class parked_queue
+{
+public:
+    parked_queue(size_t capacity) : m_queue(capacity), m_sleepers(0) {}
+    bool push(int *request)
+    {
+        if (!m_queue.push(request))
+            return false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0)
+            m_wakeup.post();
+        return true;
+    }
+    void pop(int *&request)
+    {
+        while (true)
+        {
+            for (int i = 0; i < SPIN_COUNT; ++i)
+            {
+                if (m_queue.pop(request))
+                    return;
+                cpu_relax();
+            }
+            m_sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool got = m_queue.pop(request);
+            if (!got)
+                m_wakeup.wait();
+            m_sleepers.fetch_sub(1);
+            if (got)
+                return;
+        }
+    }
+
+private:
+    Q m_queue;
+    std::atomic<int> m_sleepers;
+    sem m_wakeup;
+};
+
+template <class Q>
+struct bench
+{
+    Q *queue;
+    long items;     //每个生产者push的个数
+    std::atomic<long> sum;
+    std::atomic<bool> go;
+};
+
+template <class Q>
+static void *producer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    while (!b->go.load(std::memory_order_acquire))
+        ;
+    for (long i = 1; i <= b->items; ++i)
+    {
+        while (!b->queue->push((int *)i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+//取到NULL就退出，生产者都结束后每个消费者放一个NULL
+template <class Q>
+static void *consumer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    long sum = 0;
+    while (!b->go.load(std::memory_order_acquire))
+        ;
+    while (true)
+    {
+        int *p;
+        b->queue->pop(p);
+        if (!p)
+            break;
+        sum += (long)p;
+    }
+    b->sum.fetch_add(sum);
+    return NULL;
+}
+
+//返回每秒操作数，取出的值加起来不对返回-1
+template <class Q>
+static double run(int producers, int consumers, long items, size_t capacity)
+{
+    Q queue(capacity);
+    bench<Q> b;
+    b.queue = &queue;
+    b.items = items / producers > 0 ? items / producers : 1;
+    b.sum = 0;
+    b.go = false;
+    std::vector<pthread_t> tids(producers + consumers);
+    for (int i = 0; i < consumers; ++i)
+        pthread_create(&tids[i], NULL, consumer<Q>, &b);
+    for (int i = 0; i < producers; ++i)
+        pthread_create(&tids[consumers + i], NULL, producer<Q>, &b);
+    long long start = now_ns();
+    b.go.store(true, std::memory_order_release);
+    for (int i = 0; i < producers; ++i)
+        pthread_join(tids[consumers + i], NULL);
+    for (int i = 0; i < consumers; ++i)
+    {
+        while (!queue.push((int *)NULL))
+            sched_yield();
+    }
+    for (int i = 0; i < consumers; ++i)
+        pthread_join(tids[i], NULL);
+    long long ns = now_ns() - start;
+    if (b.sum.load() != producers * (b.items * (b.items + 1) / 2))
+        return -1;
+    return producers * b.items * 1e9 / ns;
+}
+
+//一组生产者和消费者数跑三种队列，一行输出
+static bool run_all(int producers, int consumers, long items, size_t capacity)
+{
+    double sem_ops = run<sem_queue>(producers, consumers, items, capacity);
+    double locked_ops = run<parked_queue<locked_queue<int *>>>(producers, consumers, items, capacity);
+    double mpmc_ops = run<parked_queue<mpmc_queue<int *>>>(producers, consumers, items, capacity);
+    if (sem_ops < 0 || locked_ops < 0 || mpmc_ops < 0)
+    {
+        printf("%9d %9d  lost or duplicated items\n", producers, consumers);
+        return false;
+    }
+    printf("%9d %9d %12.2f %12.2f %12.2f %8.2fx\n", producers, consumers, sem_ops / 1e6, locked_ops / 1e6, mpmc_ops / 1e6, mpmc_ops / sem_ops);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    long items = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t capacity = argc > 2 ? atol(argv[2]) : 10000;
+    int producers = argc > 4 ? atoi(argv[3]) : 0;
+    int consumers = argc > 4 ? atoi(argv[4]) : 0;
+    if (items <= 0 || capacity == 0 || argc == 4 || (argc > 4 && (producers <= 0 || consumers <= 0)))
+    {
+        printf("usage: %s [items] [capacity] [producers consumers]\n", argv[0]);
+        return 1;
+    }
+    printf("items %ld in total, capacity %zu, Mops/s\n", items, capacity);
+    printf("%9s %9s %12s %12s %12s %9s\n", "producers", "consumers", "sem_queue", "locked_queue", "mpmc_queue", "mpmc/sem");
+    if (producers)
+        return run_all(producers, consumers, items, capacity) ? 0 : 1;
+    bool ok = true;
+    for (int p = 1; p <= MAX_THREADS; p *= 2)
+    {
+        for (int c = 1; c <= MAX_THREADS; c *= 2)
+            ok = run_all(p, c, items, capacity) && ok;
+    }
+    return ok ? 0 : 1;
+}
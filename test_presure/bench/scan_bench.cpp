@@ -0,0 +1,466 @@
+// 请求报文切分的对比：先核对分隔符索引的各个实现(avx2、sse4.2、scalar)，再按抓到的真实请求比较解析速度
+// 核对：长度0到200的随机缓冲区，从随机的起点到随机的终点建索引(跨64位的字)，分隔符撒在随机位置，
+// 每个实现的位图都要和index_scalar一样，http_find的结果要和逐字节找一样；缓冲区放在可读页的末尾，越界读会直接段错误
+// 比较：几组浏览器和工具抓到的请求，按服务器的做法切出请求行的方法、url、版本和每个请求头的名字、值，
+//   bytewise：原来的做法，逐字节找行尾，请求行用strpbrk/strspn，请求头逐字节找冒号，同一行的字节要看两三遍
+//   index：先用向量指令给整个请求建一次分隔符位图，之后都查位图
+// 两种切法的结果要一样，输出每组请求平均每个请求的周期数(x86上是TSC周期，其他平台是纳秒)
+// 用法：./scan_bench [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+#include "../../http/http_scan.cpp"  //直接拿到文件里的static实现
+
+#define MAX_LEN 200
+#define BITS_WORDS 32   //和http_conn的READ_BUFFER_SIZE / 64一样，请求不超过2048字节
+
+struct impl
+{
+    const char *name;
+    index_fn fn;
+};
+
+static inline uint64_t cycles()
+{
+#ifdef HTTP_SCAN_X86
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static char random_byte(unsigned int *seed)
+{
+    static const char delims[] = {'\r', '\n', ':', ' ', '\t'};
+    if (rand_r(seed) % 6 == 0)
+        return delims[rand_r(seed) % 5];
+    return (char)(rand_r(seed) & 0xff);
+}
+
+//p + len正好是可读页的末尾
+static bool check(const impl &im, char *page_end, unsigned int *seed)
+{
+    uint64_t want[BITS_WORDS], got[BITS_WORDS];
+    for (size_t len = 0; len <= MAX_LEN; ++len)
+    {
+        char *p = page_end - len;
+        for (int k = 0; k < 64; ++k)
+        {
+            for (size_t i = 0; i < len; ++i)
+                p[i] = random_byte(seed);
+            size_t from = len ? rand_r(seed) % (len + 1) : 0;
+            size_t to = from + (len - from ? rand_r(seed) % (len - from + 1) : 0);
+            if (k == 0)
+                from = 0, to = len;
+            memset(want, 0, sizeof(want));
+            memset(got, 0, sizeof(got));
+            index_scalar(p, from, to, want);
+            im.fn(p, from, to, got);
+            if (memcmp(want, got, sizeof(want)) != 0)
+            {
+                printf("%s: len %zu index [%zu, %zu) differs from scalar\n", im.name, len, from, to);
+                return false;
+            }
+            //建好索引的范围里找冒号、空白和行尾
+            static const char pairs[][2] = {{'\r', '\n'}, {' ', '\t'}, {':', ':'}};
+            for (int d = 0; d < 3; ++d)
+            {
+                size_t a = from + (to - from ? rand_r(seed) % (to - from + 1) : 0);
+                size_t expect = a;
+                while (expect < to && p[expect] != pairs[d][0] && p[expect] != pairs[d][1])
+                    ++expect;
+                size_t found = http_find(p, got, a, to, pairs[d][0], pairs[d][1]);
+                if (found != expect)
+                {
+                    printf("%s: len %zu find from %zu: got %zu, want %zu\n", im.name, len, a, found, expect);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// 抓到的请求，一组是一次典型的访问
+struct request_set
+{
+    const char *name;
+    std::vector<const char *> requests;
+};
+
+static std::vector<request_set> captures()
+{
+    std::vector<request_set> sets;
+    //Firefox打开图片页：页面、样式、图片、图标
+    sets.push_back({"firefox", {
+        "GET /picture.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Referer: https://127.0.0.1:9006/welcome.html\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: sid=3f9a0c41d27e8b56a1c0e4f7b2d98a63\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "\r\n",
+        "GET /xxx.jpg HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+        "Accept: image/avif,image/webp,*/*\r\n"
+        "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Referer: https://127.0.0.1:9006/picture.html\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: sid=3f9a0c41d27e8b56a1c0e4f7b2d98a63\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "\r\n",
+        "GET /favicon.ico HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+        "Accept: image/avif,image/webp,*/*\r\n"
+        "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Referer: https://127.0.0.1:9006/picture.html\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: sid=3f9a0c41d27e8b56a1c0e4f7b2d98a63\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "\r\n"}});
+    //Chrome登录：打开登录页，提交表单，跳到欢迎页
+    sets.push_back({"chrome", {
+        "GET /log.html HTTP/1.1\r\n"
+        "Host: 192.168.1.20:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Windows\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: https://192.168.1.20:9006/\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "\r\n",
+        "POST /2CGISQL.cgi HTTP/1.1\r\n"
+        "Host: 192.168.1.20:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "Content-Length: 28\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Windows\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "Origin: https://192.168.1.20:9006\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: https://192.168.1.20:9006/log.html\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "\r\n"
+        "user=zhangsan&passwd=123456a",
+        "GET /welcome.html HTTP/1.1\r\n"
+        "Host: 192.168.1.20:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Windows\"\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: https://192.168.1.20:9006/2CGISQL.cgi\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cookie: sid=9d0e57b3a4c21f68e0b7d3c95a1f4e20\r\n"
+        "\r\n"}});
+    //Safari看视频页
+    sets.push_back({"safari", {
+        "GET /video.html HTTP/1.1\r\n"
+        "Host: 10.0.0.5:9006\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Cookie: sid=51c8e2a07f3b94d6e1a25c0b8f7d3e96\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4.1 Safari/605.1.15\r\n"
+        "Referer: https://10.0.0.5:9006/welcome.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n",
+        "GET /xxx.mp4 HTTP/1.1\r\n"
+        "Host: 10.0.0.5:9006\r\n"
+        "Accept: */*\r\n"
+        "Accept-Encoding: identity\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Cookie: sid=51c8e2a07f3b94d6e1a25c0b8f7d3e96\r\n"
+        "Range: bytes=0-1\r\n"
+        "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4.1 Safari/605.1.15\r\n"
+        "Referer: https://10.0.0.5:9006/video.html\r\n"
+        "Sec-Fetch-Dest: video\r\n"
+        "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"}});
+    //压测工具：请求头很短
+    sets.push_back({"wrk/curl", {
+        "GET / HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "\r\n",
+        "GET /judge.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "User-Agent: curl/8.5.0\r\n"
+        "Accept: */*\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"}});
+    return sets;
+}
+
+// 切出来的结果，两种做法要一样
+struct tokens
+{
+    int method_len, url, url_len, version, version_len;
+    int headers;
+    unsigned long sum;  //每个请求头名字和值的位置、长度混在一起
+};
+
+static void add_header(tokens &t, const char *buf, int name, int name_len, int value, int end)
+{
+    while (value < end && (buf[value] == ' ' || buf[value] == '\t'))
+        ++value;
+    while (end > value && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+        --end;
+    ++t.headers;
+    t.sum = t.sum * 131 + name * 7 + name_len * 11 + value * 13 + (end - value);
+}
+
+//原来的做法：逐字节找行尾，请求行用strpbrk/strspn，请求头逐字节找冒号
+//buf按服务器的读缓冲区处理，行尾\r\n改写成\0\0
+static bool parse_bytewise(char *buf, int n, tokens &t)
+{
+    memset(&t, 0, sizeof(t));
+    int start = 0;
+    bool first = true;
+    for (int i = 0; i < n; ++i)
+    {
+        if (buf[i] != '\r' || i + 1 >= n || buf[i + 1] != '\n')
+            continue;
+        buf[i] = buf[i + 1] = '\0';
+        char *text = buf + start;
+        int line = start, len = i - start;
+        start = i + 2;
+        ++i;
+        if (len == 0)
+            return !first;
+        if (first)
+        {
+            first = false;
+            char *url = strpbrk(text, " \t");
+            if (!url)
+                return false;
+            *url++ = '\0';
+            t.method_len = url - 1 - text;
+            url += strspn(url, " \t");
+            char *version = strpbrk(url, " \t");
+            if (!version)
+                return false;
+            *version++ = '\0';
+            version += strspn(version, " \t");
+            t.url = url - buf;
+            t.url_len = version - 1 - url;
+            t.version = version - buf;
+            t.version_len = strlen(version);
+            continue;
+        }
+        int colon = 0;
+        while (colon < len && text[colon] != ':')
+            ++colon;
+        if (colon == len || colon == 0)
+            continue;
+        add_header(t, buf, line, colon, line + colon + 1, line + len);
+    }
+    return false;
+}
+
+//现在的做法：整个请求建一次位图，行尾、空白、冒号都查位图
+static bool parse_index(index_fn index, char *buf, int n, tokens &t)
+{
+    memset(&t, 0, sizeof(t));
+    uint64_t bits[BITS_WORDS];
+    memset(bits, 0, (n + 63) / 64 * sizeof(uint64_t));  //只清要用到的字，和http_conn::next_request一样
+    index(buf, 0, n, bits);
+    int start = 0;
+    bool first = true;
+    while (start < n)
+    {
+        int i = http_find(buf, bits, start, n, '\r', '\n');
+        if (i + 1 >= n || buf[i] != '\r' || buf[i + 1] != '\n')
+            return false;
+        buf[i] = buf[i + 1] = '\0';
+        int line = start, end = i;
+        start = i + 2;
+        if (end == line)
+            return !first;
+        if (first)
+        {
+            first = false;
+            int sp = http_find(buf, bits, line, end, ' ', '\t');
+            if (sp == end)
+                return false;
+            buf[sp] = '\0';
+            t.method_len = sp - line;
+            int url = sp + 1;
+            while (url < end && (buf[url] == ' ' || buf[url] == '\t'))
+                ++url;
+            sp = http_find(buf, bits, url, end, ' ', '\t');
+            if (sp == end)
+                return false;
+            buf[sp] = '\0';
+            int version = sp + 1;
+            while (version < end && (buf[version] == ' ' || buf[version] == '\t'))
+                ++version;
+            t.url = url;
+            t.url_len = sp - url;
+            t.version = version;
+            t.version_len = end - version;
+            continue;
+        }
+        int colon = http_find(buf, bits, line, end, ':', ':');
+        if (colon == end || colon == line)
+            continue;
+        add_header(t, buf, line, colon - line, colon + 1, end);
+    }
+    return false;
+}
+
+//每轮把整组请求依次拷进读缓冲区再解析(解析会改写缓冲区)，只计解析的周期
+static double bench(const request_set &set, const impl *im, int rounds)
+{
+    char buf[2048];
+    tokens t;
+    unsigned long sink = 0;
+    uint64_t total = 0;
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (size_t k = 0; k < set.requests.size(); ++k)
+        {
+            int n = strlen(set.requests[k]);
+            memcpy(buf, set.requests[k], n);
+            uint64_t start = cycles();
+            if (im)
+                parse_index(im->fn, buf, n, t);
+            else
+                parse_bytewise(buf, n, t);
+            total += cycles() - start;
+            sink += t.sum;
+        }
+    }
+    if (sink == 1)
+        printf("unexpected\n");
+    return (double)total / ((double)rounds * set.requests.size());
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+    if (rounds <= 0)
+    {
+        printf("usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+    impl impls[3];
+    int count = 0;
+    impls[count++] = {"scalar", index_scalar};
+#ifdef HTTP_SCAN_X86
+    if (__builtin_cpu_supports("sse4.2"))
+        impls[count++] = {"sse4.2", index_sse42};
+    if (__builtin_cpu_supports("avx2"))
+        impls[count++] = {"avx2", index_avx2};
+#endif
+
+    //两页，后一页不可访问
+    long page = sysconf(_SC_PAGESIZE);
+    char *mem = (char *)mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED || mprotect(mem + page, page, PROT_NONE) != 0)
+    {
+        printf("mmap failure\n");
+        return 1;
+    }
+    unsigned int seed = 1;
+    bool ok = true;
+    for (int i = 0; i < count; ++i)
+    {
+        bool same = check(impls[i], mem + page, &seed);
+        printf("%-7s %s\n", impls[i].name, same ? "matches scalar" : "MISMATCH");
+        ok = ok && same;
+    }
+    munmap(mem, page * 2);
+
+    //两种切法的结果要一样
+    std::vector<request_set> sets = captures();
+    for (size_t s = 0; s < sets.size(); ++s)
+    {
+        for (size_t k = 0; k < sets[s].requests.size(); ++k)
+        {
+            char a[2048], b[2048];
+            int n = strlen(sets[s].requests[k]);
+            memcpy(a, sets[s].requests[k], n);
+            tokens want, got;
+            bool parsed = parse_bytewise(a, n, want);
+            for (int i = 0; i < count; ++i)
+            {
+                memcpy(b, sets[s].requests[k], n);
+                if (!parsed || !parse_index(impls[i].fn, b, n, got) || memcmp(&want, &got, sizeof(want)) != 0)
+                {
+                    printf("%s request %zu: %s tokens differ from bytewise\n", sets[s].name, k, impls[i].name);
+                    ok = false;
+                }
+            }
+        }
+    }
+    if (!ok)
+        return 1;
+
+    printf("selected: %s\n", http_scan_impl());
+#ifdef HTTP_SCAN_X86
+    printf("%-9s %9s", "cycles", "bytewise");
+#else
+    printf("%-9s %9s", "ns", "bytewise");
+#endif
+    for (int i = 0; i < count; ++i)
+        printf(" %9s", impls[i].name);
+    printf("  per request\n");
+    for (size_t s = 0; s < sets.size(); ++s)
+    {
+        printf("%-9s %9.0f", sets[s].name, bench(sets[s], NULL, rounds));
+        for (int i = 0; i < count; ++i)
+            printf(" %9.0f", bench(sets[s], &impls[i], rounds));
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,243 @@
+// 时间轮和原来按超时时间升序排列的定时器链表的对比
+// 模拟服务器的用法：先给conns个连接各挂一个定时器，之后随机挑连接刷新超时(相当于收到数据)，
+// 每刷新conns/10次走一个tick；最后把剩下的定时器全部删掉
+// 用法：./timer_bench [conns] [ops]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "../../timer/time_wheel_timer.h"
+
+#define CONN_TIMEOUT 15
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct conn;
+
+// 原来lst_timer.h里的sort_timer_lst，只保留和时间轮对比需要的部分
+struct util_timer
+{
+    util_timer() : expire(0), prev(NULL), next(NULL) {}
+    unsigned long expire;
+    conn *user_data;
+    util_timer *prev;
+    util_timer *next;
+};
+
+class sort_timer_lst
+{
+public:
+    sort_timer_lst() : cb_func(NULL), head(NULL), tail(NULL) {}
+    void add_timer(util_timer *timer)
+    {
+        if (!head)
+        {
+            head = tail = timer;
+            return;
+        }
+        if (timer->expire < head->expire)
+        {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+            return;
+        }
+        add_timer(timer, head);
+    }
+    //超时时间只会变大，往后挪到合适的位置
+    void adjust_timer(util_timer *timer)
+    {
+        util_timer *tmp = timer->next;
+        if (!tmp || timer->expire < tmp->expire)
+            return;
+        if (timer == head)
+        {
+            head = head->next;
+            head->prev = NULL;
+            timer->next = NULL;
+            add_timer(timer, head);
+        }
+        else
+        {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+            add_timer(timer, timer->next);
+        }
+    }
+    void del_timer(util_timer *timer)
+    {
+        if (timer == head && timer == tail)
+            head = tail = NULL;
+        else if (timer == head)
+        {
+            head = head->next;
+            head->prev = NULL;
+        }
+        else if (timer == tail)
+        {
+            tail = tail->prev;
+            tail->next = NULL;
+        }
+        else
+        {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+    }
+    //到期的从表头摘下，交给回调
+    void tick(unsigned long cur)
+    {
+        while (head && head->expire <= cur)
+        {
+            util_timer *tmp = head;
+            del_timer(tmp);
+            cb_func(tmp->user_data);
+        }
+    }
+
+    void (*cb_func)(conn *);
+
+private:
+    void add_timer(util_timer *timer, util_timer *lst_head)
+    {
+        util_timer *prev = lst_head;
+        util_timer *tmp = prev->next;
+        while (tmp)
+        {
+            if (timer->expire < tmp->expire)
+            {
+                prev->next = timer;
+                timer->next = tmp;
+                tmp->prev = timer;
+                timer->prev = prev;
+                break;
+            }
+            prev = tmp;
+            tmp = tmp->next;
+        }
+        if (!tmp)
+        {
+            prev->next = timer;
+            timer->prev = prev;
+            timer->next = NULL;
+            tail = timer;
+        }
+    }
+
+    util_timer *head;
+    util_timer *tail;
+};
+
+struct conn
+{
+    tw_timer<conn> tw;
+    util_timer lst;
+    bool lst_pending;   //链表的定时器节点没有pending()，单独记
+};
+
+static long expired = 0;
+static void on_expire(conn *)
+{
+    ++expired;
+}
+static void on_list_expire(conn *c)
+{
+    c->lst_pending = false;
+    ++expired;
+}
+
+// 所有连接的访问顺序提前算好，两边用同一组随机数
+static double run_wheel(std::vector<conn> &conns, const std::vector<int> &order)
+{
+    time_wheel<conn> wheel;
+    int every = conns.size() / 10 > 0 ? conns.size() / 10 : 1;
+    expired = 0;
+    long long start = now_ns();
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        conns[i].tw.user_data = &conns[i];
+        conns[i].tw.cb_func = on_expire;
+        wheel.add_timer(&conns[i].tw, CONN_TIMEOUT);
+    }
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        conn *c = &conns[order[i]];
+        if (c->tw.pending())
+            wheel.adjust_timer(&c->tw, CONN_TIMEOUT);
+        else
+            wheel.add_timer(&c->tw, CONN_TIMEOUT);  //已经超时关闭，相当于新连接复用了这个fd
+        if ((i + 1) % every == 0)
+            wheel.tick();
+    }
+    for (size_t i = 0; i < conns.size(); ++i)
+        wheel.del_timer(&conns[i].tw);
+    return (double)(now_ns() - start) / (conns.size() * 2 + order.size());
+}
+
+static double run_list(std::vector<conn> &conns, const std::vector<int> &order)
+{
+    sort_timer_lst lst;
+    lst.cb_func = on_list_expire;
+    int every = conns.size() / 10 > 0 ? conns.size() / 10 : 1;
+    unsigned long cur = 0;
+    expired = 0;
+    long long start = now_ns();
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        conns[i].lst.user_data = &conns[i];
+        conns[i].lst.expire = cur + CONN_TIMEOUT;
+        conns[i].lst_pending = true;
+        lst.add_timer(&conns[i].lst);
+    }
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        conn *c = &conns[order[i]];
+        c->lst.expire = cur + CONN_TIMEOUT;
+        if (c->lst_pending)
+            lst.adjust_timer(&c->lst);
+        else
+        {
+            c->lst_pending = true;
+            lst.add_timer(&c->lst);
+        }
+        if ((i + 1) % every == 0)
+            lst.tick(++cur);
+    }
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        if (conns[i].lst_pending)
+            lst.del_timer(&conns[i].lst);
+    }
+    return (double)(now_ns() - start) / (conns.size() * 2 + order.size());
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 10000;
+    int ops = argc > 2 ? atoi(argv[2]) : 100000;
+    if (n <= 0 || ops <= 0)
+    {
+        printf("usage: %s [conns] [ops]\n", argv[0]);
+        return 1;
+    }
+    std::vector<int> order(ops);
+    srand(1);
+    for (int i = 0; i < ops; ++i)
+        order[i] = rand() % n;
+
+    std::vector<conn> conns(n);
+    double wheel_ns = run_wheel(conns, order);
+    long wheel_expired = expired;
+    std::vector<conn> conns2(n);
+    double list_ns = run_list(conns2, order);
+    printf("conns %d, ops %d\n", n, ops);
+    printf("time wheel:  %8.1f ns/op, %ld expired\n", wheel_ns, wheel_expired);
+    printf("sorted list: %8.1f ns/op, %ld expired\n", list_ns, expired);
+    return 0;
+}
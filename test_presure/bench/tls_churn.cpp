@@ -0,0 +1,187 @@
+// TLS连接的反复建立和断开，用来在ASan/TSan下跑服务器，检查连接关闭和fd复用的竞争
+// 每个线程不停地连上服务器，随机在某一步断开：握手前、握手后不发请求、请求发一半、
+// 请求发完不等响应、流水线发几个请求只读一部分、正常读完响应；最后再正常请求一次，确认服务器还活着
+// 用法：./tls_churn [ip] [port] [threads] [seconds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+enum STEP
+{
+    STEP_TCP = 0,       //TCP连上就断开，服务器还在握手
+    STEP_HANDSHAKE,     //握手完不发请求
+    STEP_HALF_REQUEST,  //请求发一半
+    STEP_NO_READ,       //请求发完不读响应
+    STEP_PIPELINE,      //流水线发几个请求，只读一点
+    STEP_FULL,          //正常读完响应
+    STEP_COUNT
+};
+
+static const char *step_names[STEP_COUNT] = {"tcp", "handshake", "half request", "no read", "pipeline", "full"};
+
+static const char *REQUEST = "GET / HTTP/1.1\r\nHost: churn\r\nConnection: keep-alive\r\n\r\n";
+static const char *LAST_REQUEST = "GET / HTTP/1.1\r\nHost: churn\r\nConnection: close\r\n\r\n";
+
+static sockaddr_in server;
+static SSL_CTX *ctx;
+static std::atomic<bool> stop(false);
+static std::atomic<long> done[STEP_COUNT];
+static std::atomic<long> failed(0);
+
+static int connect_server()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (sockaddr *)&server, sizeof(server)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//读到响应头结束或者出错，返回读到的字节数
+static int read_response(SSL *ssl)
+{
+    char buf[4096];
+    int total = 0;
+    while (true)
+    {
+        int n = SSL_read(ssl, buf, sizeof(buf) - 1);
+        if (n <= 0)
+            return total;
+        total += n;
+        buf[n] = '\0';
+        if (strstr(buf, "\r\n\r\n"))
+            return total;
+    }
+}
+
+//返回false表示本该成功的一步失败了
+static bool churn_once(STEP step, unsigned int *seed)
+{
+    int fd = connect_server();
+    if (fd < 0)
+        return false;
+    if (step == STEP_TCP)
+    {
+        close(fd);
+        return true;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    bool ok = SSL_connect(ssl) == 1;
+    if (ok)
+    {
+        int len = strlen(REQUEST);
+        switch (step)
+        {
+        case STEP_HALF_REQUEST:
+            ok = SSL_write(ssl, REQUEST, 1 + rand_r(seed) % (len - 1)) > 0;
+            break;
+        case STEP_NO_READ:
+            ok = SSL_write(ssl, REQUEST, len) == len;
+            break;
+        case STEP_PIPELINE:
+        {
+            char buf[1024];
+            int count = 2 + rand_r(seed) % 6;
+            int n = 0;
+            for (int i = 0; i < count; ++i)
+                n += snprintf(buf + n, sizeof(buf) - n, "%s", REQUEST);
+            ok = SSL_write(ssl, buf, n) == n && SSL_read(ssl, buf, 1 + rand_r(seed) % (sizeof(buf) - 1)) > 0;
+            break;
+        }
+        case STEP_FULL:
+            ok = SSL_write(ssl, REQUEST, len) == len && read_response(ssl) > 0;
+            if (ok)
+                SSL_shutdown(ssl);
+            break;
+        default:
+            break;
+        }
+    }
+    SSL_free(ssl);
+    close(fd);
+    return ok;
+}
+
+static void *worker(void *arg)
+{
+    unsigned int seed = (unsigned int)(long)arg;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        STEP step = (STEP)(rand_r(&seed) % STEP_COUNT);
+        if (churn_once(step, &seed))
+            done[step].fetch_add(1, std::memory_order_relaxed);
+        else
+            failed.fetch_add(1, std::memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 9006;
+    int threads = argc > 3 ? atoi(argv[3]) : 8;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    if (threads <= 0 || seconds <= 0)
+    {
+        printf("usage: %s [ip] [port] [threads] [seconds]\n", argv[0]);
+        return 1;
+    }
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &server.sin_addr);
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+    {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);    //服务器用的是自签名证书
+    SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+
+    pthread_t *tids = new pthread_t[threads];
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, worker, (void *)(long)(i + 1));
+    sleep(seconds);
+    stop.store(true);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    delete[] tids;
+
+    long total = 0;
+    for (int i = 0; i < STEP_COUNT; ++i)
+    {
+        printf("%-13s %ld\n", step_names[i], done[i].load());
+        total += done[i].load();
+    }
+    printf("%ld connections in %d s, %ld failed\n", total, seconds, failed.load());
+
+    //服务器在反复断开之后还要能正常服务
+    int fd = connect_server();
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    bool alive = fd >= 0 && SSL_connect(ssl) == 1 &&
+                 SSL_write(ssl, LAST_REQUEST, strlen(LAST_REQUEST)) > 0 && read_response(ssl) > 0;
+    SSL_free(ssl);
+    if (fd >= 0)
+        close(fd);
+    SSL_CTX_free(ctx);
+    printf("server %s\n", alive ? "alive" : "NOT responding");
+    return alive ? 0 : 1;
+}
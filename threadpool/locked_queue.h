@@ -0,0 +1,67 @@
+/*************************************************************
+*list+互斥锁实现的有界队列，接口和mpmc_queue一致
+*满了push返回false，空了pop返回false，不阻塞，等待由线程池负责
+**************************************************************/
+
+#ifndef LOCKED_QUEUE_H
+#define LOCKED_QUEUE_H
+
+#include <list>
+#include <atomic>
+#include <stddef.h>
+#include "../lock/locker.h"
+
+template <class T>
+class locked_queue
+{
+public:
+    locked_queue(size_t max_size = 1024) : m_max_size(max_size), m_size(0) {}
+
+    bool push(const T &item)
+    {
+        m_mutex.lock();
+        if (m_size >= m_max_size)
+        {
+            m_mutex.unlock();
+            return false;
+        }
+        m_list.push_back(item);
+        ++m_size;
+        m_mutex.unlock();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        m_mutex.lock();
+        if (m_list.empty())
+        {
+            m_mutex.unlock();
+            return false;
+        }
+        item = m_list.front();
+        m_list.pop_front();
+        --m_size;
+        m_mutex.unlock();
+        return true;
+    }
+
+    //近似的元素个数，只用于统计
+    size_t size() const
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    size_t max_size() const
+    {
+        return m_max_size;
+    }
+
+private:
+    size_t m_max_size;
+    std::atomic<size_t> m_size;    //锁外读取，只作统计
+    std::list<T> m_list;
+    locker m_mutex;
+};
+
+#endif
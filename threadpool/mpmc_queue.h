@@ -0,0 +1,120 @@
+/*************************************************************
+*有界多生产者多消费者无锁队列(Dmitry Vyukov的环形数组算法)
+*每个槽带一个序号，生产者和消费者各自用CAS抢下标，抢到后只读写自己的槽
+*入队出队都不加锁、不分配内存，满了push返回false，空了pop返回false
+**************************************************************/
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHELINE_SIZE 64
+
+template <class T>
+class mpmc_queue
+{
+public:
+    //容量向上取到2的幂，下标取模变成按位与
+    mpmc_queue(size_t max_size = 1024)
+    {
+        if (max_size < 2)
+            max_size = 2;
+        size_t size = 1;
+        while (size < max_size)
+            size <<= 1;
+        m_mask = size - 1;
+        m_array = new cell[size];
+        if (!m_array)
+            throw std::exception();
+        for (size_t i = 0; i < size; i++)
+            m_array[i].sequence.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        delete[] m_array;
+    }
+
+    bool push(const T &item)
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_array[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)  //槽空闲，抢这个下标
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)  //转了一圈还没被消费，队列满
+                return false;
+            else    //被别的生产者抢走了，重新读下标
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        c->data = item;
+        c->sequence.store(pos + 1, std::memory_order_release);  //发布给消费者
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_array[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)  //槽里有数据，抢这个下标
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)  //还没有生产者写入，队列空
+                return false;
+            else
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+        item = c->data;
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);    //槽留给下一圈的生产者
+        return true;
+    }
+
+    //近似的元素个数，只用于统计
+    size_t size() const
+    {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t max_size() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+private:
+    //生产者和消费者的下标放在不同的缓存行，避免伪共享
+    alignas(CACHELINE_SIZE) cell *m_array;
+    size_t m_mask;
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+};
+
+#endif
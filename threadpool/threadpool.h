@@ -3,111 +3,505 @@
 
 #include <list>
 #include <cstdio>
+#include <cstring>
 #include <exception>
 #include <pthread.h>
+#include <atomic>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../affinity/affinity.h"
+#include "../log/log.h"
 
+//#define LOCKFREE_QUEUE  //每个工作线程的队列用无锁有界环形队列
+//默认为list+互斥锁
 
+#ifdef LOCKFREE_QUEUE
+#include "mpmc_queue.h"
+template <class T>
+using work_queue = mpmc_queue<T>;
+#else
+#include "locked_queue.h"
+template <class T>
+using work_queue = locked_queue<T>;
+#endif
+
+//自旋等待时提示CPU降低流水线压力
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do {} while (0)
+#endif
+
+#define SPIN_COUNT 256  //工作线程取不到任务时，休眠之前先自旋的次数
+
+//线程数自适应的参数
+#define ADJUST_INTERVAL_MS 1000 //管理线程每隔多久评估一次
+#define GROW_WAIT_US 2000       //平均排队时间超过它，且线程都在忙，就加线程
+#define GROW_BUSY_PERCENT 80    //线程利用率超过它才认为线程都在忙
+#define SHRINK_BUSY_PERCENT 20  //线程利用率低于它算一次空闲
+#define SHRINK_IDLE_ROUNDS 10   //连续空闲这么多轮才减线程
+
+//过载保护：宁可快速失败，也不让请求在队列里堆积好几秒
+#define SHED_WAIT_US 500000     //请求排队超过它就不再处理，直接回503
+
+//请求按类别分lane调度，由请求的m_lane决定进哪个队列
+//lane 0是各工作线程自己的队列；其余的lane各有一个共享队列和并发上限，
+//慢请求最多同时占用上限个线程，剩下的线程始终留给lane 0
+#define MAX_LANE 3
+
+//单调时钟，微秒
+static inline long long monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 每个工作线程一个队列：主线程把请求放到上次处理这个连接的线程的队列里，让http_conn留在同一个核的缓存中，
+// 自己队列空了的线程去别的线程的队列里偷任务，避免所有线程抢同一个队列的锁
+// 线程数在[min, max]之间自适应：管理线程统计排队时间和线程利用率，请求堵在数据库上时加线程，空闲时减线程
+// T需要提供m_worker、m_lane、m_queued_at，process()返回false表示请求换了lane，需要重新入队
 template <typename T>
 class threadpool
 {
 public:
-    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*thread_number是线程池初始也是最少的线程数，max_thread_number是最多的线程数，max_requests是请求队列中最多允许的、等待处理的请求的数量
+     *cpus非空时第i个工作线程绑到cpus[i % cpus.size()]上*/
+    threadpool(int thread_number = 8, int max_request = 10000, int max_thread_number = 64, const std::vector<int> &cpus = std::vector<int>());
     ~threadpool();
     bool append(T *request);
+    void set_lane_limit(int lane, int limit);
+    void dump_stats(const char *name = "threadpool");
 
 private:
+    enum SLOT_STATE
+    {
+        SLOT_STOPPED = 0,   //没有线程
+        SLOT_RUNNING,       //线程在运行
+        SLOT_RETIRING,      //管理线程要求它退出，处理完自己队列里的请求就退出
+        SLOT_DRAINING       //已经退出主循环，正在处理自己队列里剩下的请求，这时不能在这个槽上启动新线程
+    };
+    struct worker_slot
+    {
+        worker_slot(threadpool *p, int i, int max_requests) : pool(p), id(i), queue(max_requests), sleeping(0), state(SLOT_STOPPED) {}
+        threadpool *pool;
+        int id;
+        work_queue<T *> queue;      //本线程的请求队列，其他线程也可以从中偷
+        sem wakeup;                 //本线程休眠用的信号量
+        std::atomic<int> sleeping;  //是否在wakeup上休眠，唤醒方用CAS清零，保证只post一次
+        std::atomic<int> state;     //SLOT_STATE
+    };
+    struct lane_slot
+    {
+        lane_slot(int max_requests, int max_inflight) : queue(max_requests), limit(max_inflight), inflight(0) {}
+        work_queue<T *> queue;      //本lane的共享队列
+        std::atomic<int> limit;     //最多同时处理的请求数
+        std::atomic<int> inflight;  //正在处理的请求数
+    };
+
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
-    void run();
+    static void *manager(void *arg);
+    void run(worker_slot *self);
+    void manage();
+    bool start_worker(int i);
+    int worker_cpu(int i) const;
+    bool take(worker_slot *self, T *&request);
+    bool take_lane(int lane, T *&request);
+    void release_lane(worker_slot *self, int lane);
+    bool wake(worker_slot *slot);
+    void wake_any();
+    void handle(worker_slot *self, T *request);
 
 private:
-    int m_thread_number;        //线程池中的线程数
+    std::atomic<int> m_thread_number;   //线程池中当前的线程数，编号[0, m_thread_number)的线程在运行
+    std::atomic<int> m_slot_used;       //用过的槽数，只增不减，偷任务时扫描到这里为止
+    int m_min_thread_number;    //最少的线程数
+    int m_max_thread_number;    //最多的线程数
     int m_max_requests;         //请求队列中允许的最大请求数
-    pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; //!!  请求队列
-    locker m_queuelocker;       //保护请求队列的互斥锁
-    sem m_queuestat;            //信号量初始化为0，以判断是否有任务需要处理，任务来了加1
+    worker_slot **m_workers;    //每个工作线程的队列和休眠状态，按最大线程数分配
+    lane_slot *m_lanes[MAX_LANE];   //lane 1以后的共享队列，lane 0不用
+    std::atomic<unsigned> m_next;   //新连接轮流分配给各个线程
+    std::atomic<int> m_sleepers;    //正在休眠的线程数，没有人休眠时入队不用唤醒
     bool m_stop;                //是否结束线程
-    connection_pool *m_connPool;  //数据库
+    std::vector<int> m_cpus;    //工作线程绑定的CPU，为空则不绑
+
+    std::atomic<long> m_rejected;       //队列满被拒绝的请求数
+    std::atomic<long> m_shed;           //排队超时被丢弃的请求数
+
+    //以下为管理线程用到的统计，工作线程只做原子累加
+    std::atomic<long long> m_wait_us;   //本轮出队请求的排队时间之和
+    std::atomic<long long> m_busy_us;   //本轮工作线程处理请求的时间之和
+    std::atomic<long> m_dequeued;       //本轮出队的请求数
+    int m_idle_rounds;                  //连续空闲的轮数
+    std::atomic<long> m_grows;          //加线程的次数
+    std::atomic<long> m_shrinks;        //减线程的次数
+    locker m_decision_lock;
+    char m_last_decision[128];          //最近一次调整的原因，输出到统计里
 };
 
 template <typename T>
-threadpool<T>::threadpool( connection_pool *connPool, int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool(int thread_number, int max_requests, int max_thread_number, const std::vector<int> &cpus) : m_thread_number(0), m_slot_used(0), m_min_thread_number(thread_number), m_max_thread_number(max_thread_number), m_max_requests(max_requests), m_workers(NULL), m_next(0), m_sleepers(0), m_stop(false), m_cpus(cpus),
+    m_rejected(0), m_shed(0), m_wait_us(0), m_busy_us(0), m_dequeued(0), m_idle_rounds(0), m_grows(0), m_shrinks(0)
 {
-    if (thread_number <= 0 || max_requests <= 0)
+    if (thread_number <= 0 || max_requests <= 0 || max_thread_number < thread_number)
         throw std::exception();
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
+    m_workers = new worker_slot *[m_max_thread_number];
+    if (!m_workers)
         throw std::exception();
+    int per_worker = (max_requests + thread_number - 1) / thread_number;
+    for (int i = 0; i < m_max_thread_number; ++i)
+    {
+        //队列放在工作线程所绑核的NUMA节点上
+        numa_scope scope(worker_cpu(i) < 0 ? -1 : cpu_node(worker_cpu(i)));
+        m_workers[i] = new worker_slot(this, i, per_worker);
+    }
+    m_lanes[0] = NULL;
+    for (int i = 1; i < MAX_LANE; ++i)
+        m_lanes[i] = new lane_slot(max_requests, max_thread_number);    //默认不限制，由set_lane_limit设置
+    snprintf(m_last_decision, sizeof(m_last_decision), "start with %d thread(s)", thread_number);
     for (int i = 0; i < thread_number; ++i)
     {
         //printf("create the %dth thread\n",i);
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0) // 参数分别为 线程对象指针，线程属性，线程回调函数，运行参数
-        {
-            delete[] m_threads;
+        if (!start_worker(i))
             throw std::exception();
-        }
-        // 分离线程。线程默认是未分离状态，只有pthread_join运行了线程才算终止。detach函数将线程变为分离状态，没有被别的线程等待，自己结束就释放资源
-        if (pthread_detach(m_threads[i]))  
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
     }
+    m_thread_number = thread_number;
+    m_slot_used = thread_number;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, manager, this) != 0 || pthread_detach(tid))
+        throw std::exception();
 }
 
 template <typename T>
 threadpool<T>::~threadpool()
 {
-    delete[] m_threads;
     m_stop = true;
 }
 
+//在第i个槽上启动一个工作线程
 template <typename T>
-bool threadpool<T>::append(T *request)  //向list请求队列添加任务，通过互斥锁保证线程安全，添加完成后通过信号量提醒有任务要处理
+bool threadpool<T>::start_worker(int i)
 {
-    m_queuelocker.lock();   // 上锁
-    if (m_workqueue.size() > m_max_requests)
+    pthread_t tid;
+    m_workers[i]->state = SLOT_RUNNING;
+    if (pthread_create(&tid, NULL, worker, m_workers[i]) != 0) // 参数分别为 线程对象指针，线程属性，线程回调函数，运行参数
     {
-        m_queuelocker.unlock();
+        m_workers[i]->state = SLOT_STOPPED;
         return false;
     }
-    m_workqueue.push_back(request); // 添加请求
-    m_queuelocker.unlock(); // 解锁
-    m_queuestat.post(); // 信号量加1
+    // 分离线程。线程默认是未分离状态，只有pthread_join运行了线程才算终止。detach函数将线程变为分离状态，没有被别的线程等待，自己结束就释放资源
+    // 减线程时线程自己退出，栈随之释放
+    pthread_detach(tid);
     return true;
 }
+
+//第i个工作线程绑定的CPU，不绑返回-1
+template <typename T>
+int threadpool<T>::worker_cpu(int i) const
+{
+    if (m_cpus.empty())
+        return -1;
+    return m_cpus[i % m_cpus.size()];
+}
+
+//唤醒指定的休眠线程，它没在休眠则返回false
+template <typename T>
+bool threadpool<T>::wake(worker_slot *slot)
+{
+    int expected = 1;
+    if (slot->sleeping.load(std::memory_order_relaxed) && slot->sleeping.compare_exchange_strong(expected, 0))
+    {
+        slot->wakeup.post();
+        return true;
+    }
+    return false;
+}
+
+//唤醒任意一个休眠线程，让它去偷任务
+template <typename T>
+void threadpool<T>::wake_any()
+{
+    int n = m_thread_number.load();
+    for (int i = 0; i < n; ++i)
+    {
+        if (wake(m_workers[i]))
+            return;
+    }
+}
+
+//设置lane的并发上限，lane 0不受限制
+template <typename T>
+void threadpool<T>::set_lane_limit(int lane, int limit)
+{
+    if (lane <= 0 || lane >= MAX_LANE || limit <= 0)
+        return;
+    m_lanes[lane]->limit = limit;
+}
+
+template <typename T>
+bool threadpool<T>::append(T *request)  //放入上次处理该连接的线程的队列，队列满返回false
+{
+    int lane = request->m_lane;
+    if (lane > 0 && lane < MAX_LANE)
+    {
+        //共享lane，谁空闲谁来取
+        request->m_queued_at = monotonic_us();
+        if (!m_lanes[lane]->queue.push(request))
+        {
+            ++m_rejected;
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0)
+            wake_any();
+        return true;
+    }
+
+    int n = m_thread_number.load(std::memory_order_relaxed);
+    int target = request->m_worker;
+    if (target < 0 || target >= n)  //新连接，或者原来的线程已经被减掉
+        target = m_next.fetch_add(1, std::memory_order_relaxed) % n;
+    worker_slot *slot = m_workers[target];
+    request->m_queued_at = monotonic_us();
+    if (!slot->queue.push(request))
+    {
+        ++m_rejected;
+        return false;
+    }
+    //和run()里的栅栏配对：要么这里看到休眠者去唤醒，要么休眠者在睡前的重试里取到这个任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (slot->state.load(std::memory_order_relaxed) != SLOT_RUNNING)
+    {
+        //目标线程刚好在退出，请求留给别的线程来偷
+        wake_any();
+    }
+    else if (m_sleepers.load(std::memory_order_relaxed) > 0)
+    {
+        //目标线程在睡就叫醒它，否则它正忙，叫醒一个空闲线程来偷
+        if (!wake(slot))
+            wake_any();
+    }
+    return true;
+}
+
+//先取自己队列里的任务，没有就从别的线程的队列里偷，lane 0都没有了再看其他lane
+//已退出线程的队列里可能还留有请求，所以扫描所有用过的槽
+template <typename T>
+bool threadpool<T>::take(worker_slot *self, T *&request)
+{
+    if (self->queue.pop(request))
+        return true;
+    int used = m_slot_used.load(std::memory_order_relaxed);
+    for (int i = 1; i < used; ++i)
+    {
+        worker_slot *victim = m_workers[(self->id + i) % used];
+        if (victim->queue.pop(request))
+            return true;
+    }
+    for (int i = 1; i < MAX_LANE; ++i)
+    {
+        if (take_lane(i, request))
+            return true;
+    }
+    return false;
+}
+
+//从共享lane取一个请求，先占一个并发名额，取不到再还回去
+template <typename T>
+bool threadpool<T>::take_lane(int lane, T *&request)
+{
+    lane_slot *l = m_lanes[lane];
+    if (l->queue.size() == 0)
+        return false;
+    if (l->inflight.fetch_add(1) >= l->limit.load(std::memory_order_relaxed))
+    {
+        l->inflight.fetch_sub(1);
+        return false;
+    }
+    if (l->queue.pop(request))
+        return true;
+    l->inflight.fetch_sub(1);
+    return false;
+}
+
+//请求处理完，归还lane的并发名额
+//因为名额满而没取的请求，通常由本线程下一轮取走；本线程要退出时叫醒别的线程
+template <typename T>
+void threadpool<T>::release_lane(worker_slot *self, int lane)
+{
+    lane_slot *l = m_lanes[lane];
+    l->inflight.fetch_sub(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (self->state.load(std::memory_order_relaxed) != SLOT_RUNNING && l->queue.size() > 0)
+        wake_any();
+}
+
 template <typename T>
 void *threadpool<T>::worker(void *arg)
+{
+    worker_slot *self = (worker_slot *)arg;
+    threadpool *pool = self->pool;
+    int cpu = pool->worker_cpu(self->id);
+    if (cpu >= 0 && !pin_thread(cpu))
+        LOG_ERROR("worker %d pin to cpu %d failure", self->id, cpu);
+    pool->run(self);
+    return pool;
+}
+
+//处理一个请求，顺便累计排队时间和处理时间
+//排队超过SHED_WAIT_US的请求客户端多半已经不耐烦了，直接回503，把线程留给后面的请求
+template <typename T>
+void threadpool<T>::handle(worker_slot *self, T *request)
+{
+    long long start = monotonic_us();
+    long long wait = start - request->m_queued_at;
+    int lane = request->m_lane;     //请求在本线程手里，m_lane不会被别人改
+    m_wait_us.fetch_add(wait, std::memory_order_relaxed);
+    m_dequeued.fetch_add(1, std::memory_order_relaxed);
+
+    request->m_worker = self->id;   //记住这个连接最近由本线程处理，下次请求还放回来
+
+    if (wait > SHED_WAIT_US)
+    {
+        ++m_shed;
+        request->shed();
+    }
+    //数据库连接由需要它的处理函数自己按需获取，静态文件请求不会在连接池上排队
+    else if (!request->process())
+    {
+        //解析后发现属于别的lane(数据库请求、大文件)，放到那个lane的队列里，由它的并发上限约束
+        if (!append(request))
+            request->shed();
+    }
+    if (lane > 0 && lane < MAX_LANE)
+        release_lane(self, lane);
+    m_busy_us.fetch_add(monotonic_us() - start, std::memory_order_relaxed);
+}
+
+template <typename T>
+void threadpool<T>::run(worker_slot *self)
+{
+    while (!m_stop && self->state.load() == SLOT_RUNNING)
+    {
+        T *request = NULL;
+        //先自旋几轮，突发请求下省掉一次futex休眠和唤醒
+        for (int i = 0; i < SPIN_COUNT && !take(self, request); ++i)
+            cpu_relax();
+        if (!request)
+        {
+            //登记为休眠者后再取一次，防止和append()之间丢失唤醒；同理再看一次是否被要求退出
+            self->sleeping.store(1);
+            m_sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!take(self, request) && self->state.load() == SLOT_RUNNING)
+                self->wakeup.wait();
+            self->sleeping.store(0);
+            m_sleepers.fetch_sub(1);
+            if (!request)
+                continue;
+        }
+        handle(self, request);
+    }
+
+    //被减掉的线程：先标记为正在收尾，再把自己队列里剩下的请求处理完，最后才标记为已停止
+    //收尾期间append()不会再往这里放(放了也会唤醒别的线程来偷)，管理线程也不会在这个槽上启动新线程
+    self->state.store(SLOT_DRAINING);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    T *request = NULL;
+    while (!m_stop && self->queue.pop(request))
+        handle(self, request);
+    self->state.store(SLOT_STOPPED);
+}
+
+template <typename T>
+void *threadpool<T>::manager(void *arg)
 {
     threadpool *pool = (threadpool *)arg;
-    pool->run();
+    pool->manage();
     return pool;
 }
+
+//管理线程：每隔ADJUST_INTERVAL_MS评估一次，决定加线程还是减线程
 template <typename T>
-void threadpool<T>::run()
+void threadpool<T>::manage()
 {
     while (!m_stop)
     {
-        m_queuestat.wait(); // 阻塞当前进程直到信号量大于0，然后信号量减1
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+        usleep(ADJUST_INTERVAL_MS * 1000);
+        int n = m_thread_number.load();
+        long long wait_us = m_wait_us.exchange(0);
+        long long busy_us = m_busy_us.exchange(0);
+        long dequeued = m_dequeued.exchange(0);
+        long long avg_wait = dequeued ? wait_us / dequeued : 0;
+        int busy_percent = (int)(busy_us * 100 / ((long long)n * ADJUST_INTERVAL_MS * 1000));
+
+        char decision[128] = {0};
+        if (avg_wait > GROW_WAIT_US && busy_percent > GROW_BUSY_PERCENT && n < m_max_thread_number)
         {
-            m_queuelocker.unlock();
-            continue;
+            //请求在排队，线程又都在忙(比如都堵在数据库上)，加一个线程
+            //上一次减掉的线程可能还没处理完剩下的请求，等它停下来再复用这个槽
+            m_idle_rounds = 0;
+            if (m_workers[n]->state.load() == SLOT_STOPPED && start_worker(n))
+            {
+                m_thread_number = n + 1;
+                if (m_slot_used.load() < n + 1)
+                    m_slot_used = n + 1;
+                ++m_grows;
+                snprintf(decision, sizeof(decision), "grow to %d: avg wait %lldus, busy %d%%", n + 1, avg_wait, busy_percent);
+            }
+        }
+        else if (busy_percent < SHRINK_BUSY_PERCENT && n > m_min_thread_number)
+        {
+            if (++m_idle_rounds >= SHRINK_IDLE_ROUNDS)
+            {
+                //持续空闲，减掉编号最大的线程，释放它的栈
+                m_idle_rounds = 0;
+                worker_slot *slot = m_workers[n - 1];
+                m_thread_number = n - 1;
+                slot->state.store(SLOT_RETIRING);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                wake(slot);
+                ++m_shrinks;
+                snprintf(decision, sizeof(decision), "shrink to %d: busy %d%% for %d rounds", n - 1, busy_percent, SHRINK_IDLE_ROUNDS);
+            }
+        }
+        else
+        {
+            m_idle_rounds = 0;
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-        if (!request)
-            continue;
 
-        connectionRAII mysqlcon(&request->mysql, m_connPool);
-        
-        request->process();
+        if (decision[0])
+        {
+            m_decision_lock.lock();
+            strcpy(m_last_decision, decision);
+            m_decision_lock.unlock();
+            LOG_INFO("threadpool %s", decision);
+        }
+    }
+}
+
+//输出线程池的统计信息
+template <typename T>
+void threadpool<T>::dump_stats(const char *name)
+{
+    size_t queued = 0;
+    int used = m_slot_used.load();
+    for (int i = 0; i < used; ++i)
+        queued += m_workers[i]->queue.size();
+    m_decision_lock.lock();
+    LOG_INFO("stats: %s %d thread(s) [%d, %d], %lu queued, %ld rejected, %ld shed, %ld grow(s), %ld shrink(s), last: %s",
+             name, m_thread_number.load(), m_min_thread_number, m_max_thread_number, (unsigned long)queued, m_rejected.load(), m_shed.load(),
+             m_grows.load(), m_shrinks.load(), m_last_decision);
+    m_decision_lock.unlock();
+    for (int i = 1; i < MAX_LANE; ++i)
+    {
+        if (m_lanes[i]->limit.load() >= m_max_thread_number)   //没设置上限的lane不输出
+            continue;
+        LOG_INFO("stats: %s lane %d %lu queued, %d/%d in flight", name, i, (unsigned long)m_lanes[i]->queue.size(),
+                 m_lanes[i]->inflight.load(), m_lanes[i]->limit.load());
     }
 }
 #endif
@@ -2,146 +2,213 @@
 #define TIME_WHEEL_TIMER
 
 #include <time.h>
+#include <netinet/in.h>
 #include "../log/log.h"
 
-struct client_data
-{
-    sockaddr_in address;
-    int sockfd;
-    time_wheel_timer *timer;
-};
+// 分层时间轮，和内核的timer wheel同一个思路：
+// 第0层256个槽，每个槽1个tick；往上3层各64个槽，每层一个槽覆盖下一层一整圈
+// 定时器按到期tick和当前tick的差值放进对应层的槽里，添加、刷新、删除都是O(1)，
+// 第0层转完一圈时把上一层当前槽里的定时器重新分散到下层(cascade)
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVEL 3
+#define MAX_TIMEOUT ((1UL << (TVR_BITS + TVN_LEVEL * TVN_BITS)) - 1)    //能表示的最大超时tick数
 
-class time_wheel_timer
+// 定时器节点，侵入式地嵌在用户数据里，不需要每次添加都new一个
+// 同一个槽里的定时器组成带哨兵的双向循环链表，next不为空表示定时器在轮上
+template <typename T>
+class tw_timer
 {
 public:
-    int rotation; // 记录定时器在时间轮转多少圈后失效
-    int time_slot; // 记录定时器属于时间轮上的哪个槽
-    void (*cb_func)(client_data*); // 定时器回调函数
-    client_data *user_data; //客户数据
-    time_wheel_timer *next;
-    time_wheel_timer *prev;
+    tw_timer() : prev(NULL), next(NULL), expire(0), cb_func(NULL), user_data(NULL) {}
+    bool pending() const
+    {
+        return next != NULL;
+    }
 
 public:
-    time_wheel_timer(int rot, int ts) : next(NULL), prev(NULL), rotation(rot), time_slot(ts) {}
+    tw_timer *prev;
+    tw_timer *next;
+    unsigned long expire;   //到期的绝对tick
+    void (*cb_func)(T *);   //定时器回调函数
+    T *user_data;           //客户数据
 };
 
+template <typename T>
 class time_wheel
 {
-private:
-    /* data */
-    static const int N = 60; // 时间轮上的槽的数目
-    static const int SI = 1; // 每1s时间轮轮动一次，槽间隔为1s
-    time_wheel_timer *slots[N]; // 时间轮的槽，其中每个元素指向一个定时器链表，链表无序
-    int cur_slot; // 时间轮的当前槽
-    
 public:
-    time_wheel() : cur_slot(0) {
-        for (int i = 0; i < N; i++) {
-            slots[i] = NULL;
-        }
+    time_wheel() : m_jiffies(0)
+    {
+        for (int i = 0; i < TVR_SIZE; i++)
+            init_head(&m_tv1[i]);
+        for (int n = 0; n < TVN_LEVEL; n++)
+            for (int i = 0; i < TVN_SIZE; i++)
+                init_head(&m_tvn[n][i]);
     }
 
-    ~time_wheel() {
-        for (int i = 0; i < N; i++) {
-            time_wheel_timer *tmp = slots[i];
-            while (tmp) {
-                slots[i] = tmp->next;
-                delete tmp;
-                tmp = slots[i];
-            }
-        }
-    }    
+    // 定时器节点归用户数据所有，析构时只把它们从轮上摘下来
+    ~time_wheel()
+    {
+        for (int i = 0; i < TVR_SIZE; i++)
+            detach_all(&m_tv1[i]);
+        for (int n = 0; n < TVN_LEVEL; n++)
+            for (int i = 0; i < TVN_SIZE; i++)
+                detach_all(&m_tvn[n][i]);
+    }
 
-    // 根据定时值timeout创建一个定时器，并把它插入合适槽中
-    time_wheel_timer *add_timer(int timeout) {
-        if (timeout < 0) {
-            return NULL;
-        }
-        int ticks = 0;
-        /* 下面根据待插入定时器的超时值计算它将在时间轮转动多少个滴答后被触发，
-        并将该滴答数存在变量ticks中，如果待插入定时器的超时值小于时间轮的槽间隔SI则将ticks向上折合为1， 
-        否则就将ticks向下折合为timeout / SI */
-        if (timeout < SI) {
-            ticks = 1;
-        }
-        else {
-            ticks = timeout / SI;
-        }
-        // 计算待插入的定时器在时间轮转动多少圈后被触发
-        int rotation = ticks / N;
-        // 计算待插入的定时器应该被插入哪个槽中
-        int ts = (cur_slot + (ticks % N)) % N;
-        // 创建新的定时器，它在时间轮转动rotation圈之后被触发，且位于第ts个槽上
-        time_wheel_timer *timer = new time_wheel_timer(rotation, ts);
-        // 如果第ts个槽中尚无任何定时器，则把新建的定时器插入其中，并将该定时器设置为该槽的头结点
-        if (!slots[ts]) {
-            slots[ts] = timer;
-        }
-        else {
-            timer->next = slots[ts];
-            slots[ts]->prev = timer;
-            slots[ts] = timer;
-        }
-        return timer;
+    // timeout个tick之后触发，至少为1
+    void add_timer(tw_timer<T> *timer, unsigned long timeout)
+    {
+        if (!timer || timer->pending())
+            return;
+        if (timeout == 0)
+            timeout = 1;
+        if (timeout > MAX_TIMEOUT)
+            timeout = MAX_TIMEOUT;
+        timer->expire = m_jiffies + timeout - 1;  //m_jiffies是下一个要处理的tick
+        internal_add(timer);
     }
 
-    // 删除定时器
-    void del_timer(time_wheel_timer *timer) {
-        if (!timer) {
+    // 连接上有数据交换时刷新超时时间，先摘下再放到新的槽里
+    void adjust_timer(tw_timer<T> *timer, unsigned long timeout)
+    {
+        if (!timer)
             return;
-        }
-        int ts = timer->time_slot;
-        // slots[ts] 是目标定时器所在槽的头结点，如果目标定时器就是头结点，则需要重置第ts个槽的头结点
-        if (timer == slots[ts]) {
-            slots[ts] = slots[ts]->next;
-            if (slots[ts]) {
-                slots[ts]->prev = NULL;
+        del_timer(timer);
+        add_timer(timer, timeout);
+    }
+
+    void del_timer(tw_timer<T> *timer)
+    {
+        if (!timer || !timer->pending())
+            return;
+        unlink(timer);
+    }
+
+    // 时间轮向前走一个tick，执行当前槽上到期的定时器
+    void tick()
+    {
+        int index = m_jiffies & TVR_MASK;
+        // 第0层转完一圈，从上一层取一个槽下来；上一层也转完一圈就继续往上
+        if (!index)
+        {
+            for (int n = 0; n < TVN_LEVEL; n++)
+            {
+                if (cascade(n, level_index(n)) != 0)
+                    break;
             }
-            delete timer;
         }
-        else {
-            timer->prev->next = timer->next;
-            if (timer->next) {
-                timer->next->prev = timer->prev;
-            }
-            delete timer;
+        ++m_jiffies;
+
+        // 先把整条链表挪到局部哨兵下，回调里增删别的定时器也不会影响遍历
+        tw_timer<T> expired;
+        init_head(&expired);
+        splice(&m_tv1[index], &expired);
+        while (expired.next != &expired)
+        {
+            tw_timer<T> *timer = expired.next;
+            unlink(timer);
+            timer->cb_func(timer->user_data);
         }
     }
 
-    // SI时间到后，调用该函数，时间轮向前滚动一个槽的间隔
-    void tick() {
-        time_wheel_timer *tmp = slots[cur_slot]; // 取得当前槽上头结点
-        while (tmp)
+    unsigned long now() const
+    {
+        return m_jiffies;
+    }
+
+private:
+    void internal_add(tw_timer<T> *timer)
+    {
+        unsigned long expire = timer->expire;
+        unsigned long idx = expire - m_jiffies;
+        tw_timer<T> *head;
+        if ((long)idx < 0)  //已经过期的放到下一个要处理的槽里
+            head = &m_tv1[m_jiffies & TVR_MASK];
+        else if (idx < TVR_SIZE)
+            head = &m_tv1[expire & TVR_MASK];
+        else
         {
-            // 如果定时器的rotation值大于0，则在这一轮不起作用
-            if (tmp->rotation > 0) {
-                tmp->rotation--;
-                tmp = tmp->next;
-            }   
-            //否则说明定时器已经到期，于是执行定时任务，然后删除该定时器
-            else {
-                tmp->cb_func(tmp->user_data);
-                if (tmp == slots[cur_slot]) {
-                    slots[cur_slot] = tmp->next;
-                    delete tmp;
-                    if (slots[cur_slot]) {
-                        slots[cur_slot]->prev = NULL;
-                    }
-                    tmp = slots[cur_slot];
-                }
-                else {
-                    tmp->prev->next = tmp->next;
-                    if (tmp->next) {
-                        tmp->next->prev = tmp->prev;
-                    }
-                    time_wheel_timer *tmp2 = tmp->next;
-                    delete tmp;
-                    tmp = tmp2;
-                }
-            }
+            int n = 0;
+            while (n < TVN_LEVEL - 1 && idx >= (1UL << (TVR_BITS + (n + 1) * TVN_BITS)))
+                n++;
+            head = &m_tvn[n][(expire >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK];
         }
-        cur_slot = ++cur_slot % N;
+        // 插到槽链表的尾部
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    // 把第n层第index个槽里的定时器按剩余时间重新放回轮上，返回index，为0表示这一层也转完了一圈
+    int cascade(int n, int index)
+    {
+        tw_timer<T> list;
+        init_head(&list);
+        splice(&m_tvn[n][index], &list);
+        while (list.next != &list)
+        {
+            tw_timer<T> *timer = list.next;
+            unlink(timer);
+            internal_add(timer);
+        }
+        return index;
+    }
+
+    int level_index(int n) const
+    {
+        return (m_jiffies >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK;
+    }
+
+    static void init_head(tw_timer<T> *head)
+    {
+        head->prev = head;
+        head->next = head;
+    }
+
+    static void unlink(tw_timer<T> *timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+    }
+
+    // 把from上的整条链表接到空链表to上，from变为空
+    static void splice(tw_timer<T> *from, tw_timer<T> *to)
+    {
+        if (from->next == from)
+            return;
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        init_head(from);
     }
+
+    static void detach_all(tw_timer<T> *head)
+    {
+        while (head->next != head)
+            unlink(head->next);
+    }
+
+private:
+    unsigned long m_jiffies;                    //下一个要处理的tick
+    tw_timer<T> m_tv1[TVR_SIZE];                //第0层，每个槽1个tick
+    tw_timer<T> m_tvn[TVN_LEVEL][TVN_SIZE];     //上面的几层
+};
+
+struct client_data
+{
+    sockaddr_in address;    //地址族，端口号，ip
+    int sockfd;
+    tw_timer<client_data> timer;    //嵌在连接数据里的定时器
 };
 
-#endif
\ No newline at end of file
+#endif